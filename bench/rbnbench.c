@@ -0,0 +1,903 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+// The implementation is included here so internal block functions can be timed directly
+#define RBN_IMPLEMENTATION
+#define RBN_GENERAL_IMPLEMENTATION
+#define RBN_ATTACK_CACHE
+#include "../robin_general.h"
+
+#include "rbnbench.h"
+
+#include "../util/rbnutil_workload.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#define RBNBENCH_MAX_ITERATIONS 100000
+#define RBNBENCH_BATCH_BLOCKS 8
+#define RBNBENCH_OUTPUT_SAMPLES 4096
+#define RBNBENCH_STREAM_EVENTS 64
+#define RBNBENCH_FUZZ_BYTES 512
+#define RBNBENCH_INSTANCE_COUNT 8
+#define RBNBENCH_INSTANCE_SAMPLES 65536
+#define RBNBENCH_INSTANCE_EVENTS 512
+#define RBNBENCH_WORKLOAD_EVENTS 8192
+#define RBNBENCH_WORKLOAD_MS 500
+
+static const uint32_t sample_rate = 44100;
+
+static rbn_instance base_inst; // Initialized once, copied before each benchmark
+static rbn_instance inst;
+
+static uint32_t iterations = 1000;
+static const char* filter = NULL;
+static uint32_t result_count = 0;
+static double values[RBNBENCH_MAX_ITERATIONS];
+static double secondary_values[RBNBENCH_MAX_ITERATIONS];
+static int use_perf = 0;
+static rbnbench_counters counters;
+static int16_t output_buffer[RBNBENCH_OUTPUT_SAMPLES * 2];
+
+static const uint32_t workload_kinds[] = {
+  rbnutil_workload_polyphony,
+  rbnutil_workload_retrigger,
+  rbnutil_workload_bend,
+  rbnutil_workload_percussion,
+  rbnutil_workload_controls,
+  rbnutil_workload_all,
+};
+
+static uint64_t get_time_ns() {
+#ifdef _WIN32
+  static double mult = 0.0;
+  if(mult == 0.0) {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    mult = 1000000000.0 / (double)freq.QuadPart;
+  }
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)(counter.QuadPart * mult);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static int compare_double(const void* a, const void* b) {
+  const double da = *(const double*)a;
+  const double db = *(const double*)b;
+  return (da > db) - (da < db);
+}
+
+static int is_enabled(const char* name) {
+  return !filter || strstr(name, filter);
+}
+
+// Prints a result object without closing it so more fields can follow
+static void begin_result(const char* name, const char* unit, double* samples, uint32_t count) {
+  qsort(samples, count, sizeof(double), compare_double);
+  printf("%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"iterations\": %u, \"min\": %.3f, \"median\": %.3f, \"p99\": %.3f",
+    result_count++ ? "," : "", name, unit, count, samples[0], samples[count / 2], samples[(count - 1) * 99 / 100]);
+}
+
+static void end_result() {
+  printf("}");
+  fflush(stdout);
+}
+
+static void report_values(const char* name, const char* unit, double* samples, uint32_t count) {
+  begin_result(name, unit, samples, count);
+  end_result();
+}
+
+static void report(const char* name, const char* unit, uint32_t count) {
+  report_values(name, unit, values, count);
+}
+
+// Same as report, with hardware counters totalled over all iterations
+// Voice samples are the samples rendered by each voice summed, which tells the per-voice cost apart
+static void report_counters(const char* name, const char* unit, uint32_t count, uint64_t unit_count, uint64_t voice_samples) {
+  if(!use_perf) {
+    report(name, unit, count);
+    return;
+  }
+  begin_result(name, unit, values, count);
+  printf(", \"perf\": {");
+
+  const char* separator = "";
+  for(uint32_t i = 0; i < rbnbench_max_counters; i++) {
+    if(counters.available_mask & (1 << i)) {
+      printf("%s\"%s\": %.3f", separator, rbnbench_perf_name(i), (double)counters.values[i] / unit_count);
+      separator = ", ";
+    }
+  }
+  const uint32_t ipc_mask = (1 << rbnbench_cycles) | (1 << rbnbench_instructions);
+  if((counters.available_mask & ipc_mask) == ipc_mask && counters.values[rbnbench_cycles] > 0) {
+    printf("%s\"ipc\": %.3f", separator, (double)counters.values[rbnbench_instructions] / counters.values[rbnbench_cycles]);
+    separator = ", ";
+  }
+  if((counters.available_mask & (1 << rbnbench_cycles)) && voice_samples > 0) {
+    printf("%s\"cycles_per_voice_sample\": %.3f", separator, (double)counters.values[rbnbench_cycles] / voice_samples);
+  }
+  printf("}");
+  end_result();
+}
+
+static void reset_instance() {
+  memcpy(&inst, &base_inst, sizeof(rbn_instance));
+}
+
+static void render_blocks(uint32_t count) {
+  for(uint32_t i = 0; i < count; i++) {
+    memset(inst.sample_buffer, 0, sizeof(inst.sample_buffer));
+    rbn_render_block(&inst, inst.sample_buffer, NULL);
+    inst.sample_index += RBN_BLOCK_SAMPLES;
+  }
+  inst.output_index = inst.sample_index;
+}
+
+static int any_voice_active() {
+  for(uintptr_t i = 0; i < RBN_VOICE_COUNT; i++) {
+    if(inst.voices[i].inactive_index > inst.sample_index) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Measures block cost in ns while the note sequence is retriggered whenever all voices are done
+static void measure_blocks(const char* name, void (*trigger)(void*), void* data) {
+  if(!is_enabled(name)) {
+    return;
+  }
+  memset(&counters, 0, sizeof(counters));
+  trigger(data);
+  const uint64_t rendered_samples = inst.rendered_samples;
+  for(uint32_t i = 0; i < iterations; i++) {
+    if(!any_voice_active()) {
+      trigger(data);
+    }
+    // Counter syscalls stay outside of the timed region
+    if(use_perf) {
+      rbnbench_perf_start();
+    }
+    const uint64_t start = get_time_ns();
+    render_blocks(RBNBENCH_BATCH_BLOCKS);
+    const uint64_t end = get_time_ns();
+    if(use_perf) {
+      rbnbench_perf_stop(&counters);
+    }
+    values[i] = (double)(end - start) / RBNBENCH_BATCH_BLOCKS;
+  }
+  report_counters(name, "ns/block", iterations, (uint64_t)iterations * RBNBENCH_BATCH_BLOCKS, inst.rendered_samples - rendered_samples);
+}
+
+static void trigger_program(void* data) {
+  const uint8_t program = (uint8_t)(uintptr_t)data;
+  if(program < 128) {
+    rbn_set_program(&inst, 0, program);
+    rbn_play_note(&inst, 0, 60, 127);
+  } else {
+    rbn_play_note(&inst, RBN_KEYMAP_CHANNEL, program - RBN_KEYMAP_OFFSET, 127);
+  }
+}
+
+static void bench_programs() {
+  char name[64];
+  for(uintptr_t i = 0; i < RBN_PROGRAM_COUNT; i++) {
+    snprintf(name, sizeof(name), "program/%" PRIuPTR, i);
+    reset_instance();
+    measure_blocks(name, trigger_program, (void*)i);
+  }
+}
+
+static void trigger_synthetic(void* data) {
+  rbn_play_note(&inst, 0, 60, 127);
+}
+
+// Program made of a number of sustained operators with a given share of the modulation matrix filled
+static void setup_synthetic_program(uint32_t operator_count, uint32_t density_percent) {
+  rbn_program* program = inst.programs;
+  memset(program, 0, sizeof(rbn_program));
+  uint32_t seed = operator_count * 100 + density_percent;
+  for(uint32_t i = 0; i < operator_count; i++) {
+    rbn_operator* op = program->operators + i;
+    op->freq_ratio = (float)(i + 1);
+    op->output = 1.f / operator_count;
+    op->volume_envelope.points[0].value = 1.f;
+    op->volume_envelope.release_time = -1.f;
+    for(uint32_t j = 0; j < operator_count; j++) {
+      seed = seed * 1103515245 + 12345;
+      if((seed >> 16) % 100 < density_percent) {
+        program->op_matrix[i][j] = 0.5f;
+      }
+    }
+  }
+  rbn_refresh(&inst);
+}
+
+static void bench_operators() {
+  static const uint32_t densities[] = {0, 25, 50, 100};
+  char name[64];
+  for(uint32_t operator_count = 1; operator_count <= RBN_OPERATOR_COUNT; operator_count++) {
+    for(uintptr_t i = 0; i < sizeof(densities) / sizeof(*densities); i++) {
+      snprintf(name, sizeof(name), "operators/%u/modulation/%u", operator_count, densities[i]);
+      reset_instance();
+      setup_synthetic_program(operator_count, densities[i]);
+      rbn_set_program(&inst, 0, 0);
+      measure_blocks(name, trigger_synthetic, NULL);
+    }
+  }
+}
+
+static void trigger_voices(void* data) {
+  const uint32_t voice_count = (uint32_t)(uintptr_t)data;
+  for(uint32_t i = 0; i < voice_count; i++) {
+    rbn_play_note(&inst, i % 16 == RBN_KEYMAP_CHANNEL ? 0 : i % 16, (uint8_t)(i % 128), 127);
+  }
+}
+
+static void bench_voices() {
+  char name[64];
+  for(uint32_t voice_count = 1; voice_count <= RBN_VOICE_COUNT; voice_count *= 2) {
+    snprintf(name, sizeof(name), "voices/%u", voice_count);
+    reset_instance();
+    measure_blocks(name, trigger_voices, (void*)(uintptr_t)voice_count);
+  }
+}
+
+// Every keymapped key at once, synthesized then played back from one-shots with 4 noise variations
+static void trigger_keymap(void* data) {
+  for(uint8_t key = 0; RBN_KEYMAP_OFFSET + key < RBN_PROGRAM_COUNT; key++) {
+    rbn_play_note(&inst, RBN_KEYMAP_CHANNEL, key, 127);
+  }
+}
+
+static void bench_keymap() {
+  reset_instance();
+  measure_blocks("keymap/synthesized", trigger_keymap, NULL);
+
+  if(!is_enabled("keymap/oneshots")) {
+    return;
+  }
+  reset_instance();
+  const size_t size = rbn_oneshot_size(&inst, 4);
+  void* memory = malloc(size);
+  rbn_oneshot_init(&inst, memory, size, 4);
+  measure_blocks("keymap/oneshots", trigger_keymap, NULL);
+  reset_instance();
+  free(memory);
+}
+
+// The first blocks of a chord of 16 notes, restarted every iteration so only attacks are timed
+static void measure_attack(const char* name) {
+  if(!is_enabled(name)) {
+    return;
+  }
+  for(uint32_t i = 0; i < iterations; i++) {
+    rbn_reset(&inst);
+    for(uint8_t key = 48; key < 64; key++) {
+      rbn_play_note(&inst, 0, key, 127);
+    }
+    const uint64_t start = get_time_ns();
+    render_blocks(RBNBENCH_BATCH_BLOCKS);
+    values[i] = (double)(get_time_ns() - start) / RBNBENCH_BATCH_BLOCKS;
+  }
+  report_values(name, "ns/block", values, iterations);
+}
+
+static void bench_attack() {
+  reset_instance();
+  measure_attack("attack/synthesized");
+
+  if(!is_enabled("attack/cached")) {
+    return;
+  }
+  reset_instance();
+  const size_t size = 16 * rbn_attack_cache_slot_size(&inst, 1.f);
+  void* memory = malloc(size);
+  rbn_attack_cache_init(&inst, memory, size, 1.f);
+  measure_attack("attack/cached");
+  reset_instance();
+  free(memory);
+}
+
+// Bursts of note, control and pitch bend messages followed by one block of rendering
+// Voices are stopped between bursts so the voice search always starts from the same state
+static void bench_events() {
+  static const uint32_t event_counts[] = {4, 16, 64};
+  char name[64];
+  char render_name[64];
+  for(uintptr_t e = 0; e < sizeof(event_counts) / sizeof(*event_counts); e++) {
+    const uint32_t event_count = event_counts[e];
+    snprintf(name, sizeof(name), "events/%u/dispatch", event_count);
+    snprintf(render_name, sizeof(render_name), "events/%u/render", event_count);
+    if(!is_enabled(name) && !is_enabled(render_name)) {
+      continue;
+    }
+    reset_instance();
+    uint32_t seed = event_count;
+    for(uint32_t i = 0; i < iterations; i++) {
+      rbn_msg msgs[64] = {0};
+      for(uint32_t j = 0; j < event_count; j++) {
+        seed = seed * 1103515245 + 12345;
+        rbn_msg* msg = msgs + j;
+        msg->channel = (seed >> 8) % 16;
+        msg->u8[2] = (seed >> 12) % 128;
+        msg->u8[3] = (seed >> 20) % 128;
+        switch((seed >> 28) % 4) {
+          case 0: msg->type = rbn_note_on; break;
+          case 1: msg->type = rbn_note_off; break;
+          case 2: msg->type = rbn_control_change; msg->control = rbn_volume; break;
+          default: msg->type = rbn_pitch_bend; break;
+        }
+      }
+
+      const uint64_t start = get_time_ns();
+      for(uint32_t j = 0; j < event_count; j++) {
+        rbn_send_msg(&inst, msgs[j]);
+      }
+      const uint64_t dispatched = get_time_ns();
+      render_blocks(1);
+      values[i] = (double)(dispatched - start) / event_count;
+      secondary_values[i] = (double)(get_time_ns() - dispatched);
+
+      rbn_stop_all_notes(&inst);
+    }
+    if(is_enabled(name)) {
+      report_values(name, "ns/event", values, iterations);
+    }
+    if(is_enabled(render_name)) {
+      report_values(render_name, "ns/block", secondary_values, iterations);
+    }
+  }
+}
+
+static uint32_t next_random(uint32_t* seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+static uint8_t data_length(uint8_t status) {
+  return (status & 0xf0) == rbn_program_change || (status & 0xf0) == rbn_channel_pressure ? 1 : 2;
+}
+
+// Raw MIDI dispatch through rbn_send_bytes, with or without running status
+static void bench_bytes() {
+  static const struct {
+    const char* name;
+    int running_status;
+  } streams[] = {
+    {"bytes/status", 0},
+    {"bytes/running_status", 1},
+  };
+  static const uint8_t types[] = {rbn_note_on, rbn_note_off, rbn_control_change, rbn_pitch_bend};
+  uint8_t bytes[RBNBENCH_STREAM_EVENTS * 3];
+  for(uintptr_t b = 0; b < sizeof(streams) / sizeof(*streams); b++) {
+    if(!is_enabled(streams[b].name)) {
+      continue;
+    }
+    reset_instance();
+    uint32_t seed = 1;
+    for(uint32_t i = 0; i < iterations; i++) {
+      // Long runs of the same status on one channel, as sent by a keyboard
+      size_t size = 0;
+      uint8_t status = 0;
+      for(uint32_t j = 0; j < RBNBENCH_STREAM_EVENTS; j++) {
+        if(j % 16 == 0) {
+          status = types[next_random(&seed) % 4] | (next_random(&seed) % 8);
+        }
+        if(!streams[b].running_status || j % 16 == 0) {
+          bytes[size++] = status;
+        }
+        bytes[size++] = next_random(&seed) % 128;
+        bytes[size++] = (status & 0xf0) == rbn_control_change ? rbn_volume : next_random(&seed) % 128;
+      }
+
+      const uint64_t start = get_time_ns();
+      rbn_send_bytes(&inst, bytes, size);
+      values[i] = (double)(get_time_ns() - start) / RBNBENCH_STREAM_EVENTS;
+
+      rbn_stop_all_notes(&inst);
+    }
+    begin_result(streams[b].name, "ns/event", values, iterations);
+    printf(", \"events_per_second\": %.0f", 1000000000.0 / values[iterations / 2]);
+    end_result();
+  }
+}
+
+// Conversion of the internal float buffer to output samples, with no voice playing
+// rbn_render without its fast path for silent blocks, so that conversion is timed without voices
+static void render_output(rbn_output_config* output_config) {
+  while(rbn_output_samples(&inst, output_config) > 0) {
+    memset(inst.sample_buffer, 0, sizeof(inst.sample_buffer));
+    rbn_render_block(&inst, inst.sample_buffer, NULL);
+    inst.sample_index += RBN_BLOCK_SAMPLES;
+  }
+}
+
+static void bench_output() {
+  static const struct {
+    const char* name;
+    rbn_sample_format format;
+  } formats[] = {
+    {"output/s16", rbn_s16},
+    {"output/f32", rbn_f32},
+    {"output/idle", rbn_s16},
+  };
+  for(uintptr_t f = 0; f < sizeof(formats) / sizeof(*formats); f++) {
+    if(!is_enabled(formats[f].name)) {
+      continue;
+    }
+    reset_instance();
+    memset(&counters, 0, sizeof(counters));
+    const int idle = !strcmp(formats[f].name, "output/idle");
+    for(uint32_t i = 0; i < iterations; i++) {
+      // The f32 format needs twice the room of s16 so only half as many samples fit
+      rbn_output_config output_config = {
+        .left_buffer = output_buffer,
+        .right_buffer = formats[f].format == rbn_f32 ? (void*)((float*)output_buffer + 1) : (void*)(output_buffer + 1),
+        .stride = 2,
+        .sample_count = RBNBENCH_OUTPUT_SAMPLES / 2,
+        .sample_format = formats[f].format,
+      };
+      if(use_perf) {
+        rbnbench_perf_start();
+      }
+      const uint64_t start = get_time_ns();
+      if(idle) {
+        rbn_render(&inst, &output_config);
+      } else {
+        render_output(&output_config);
+      }
+      const uint64_t end = get_time_ns();
+      if(use_perf) {
+        rbnbench_perf_stop(&counters);
+      }
+      values[i] = (double)(end - start) / (RBNBENCH_OUTPUT_SAMPLES / 2);
+    }
+    report_counters(formats[f].name, "ns/sample", iterations, (uint64_t)iterations * (RBNBENCH_OUTPUT_SAMPLES / 2), 0);
+  }
+}
+
+// Blocks of a seeded stress workload played from its start, with the events due in each block
+// dispatched inside the timed region
+static void bench_workloads() {
+  char name[64];
+  for(uintptr_t k = 0; k < sizeof(workload_kinds) / sizeof(*workload_kinds); k++) {
+    snprintf(name, sizeof(name), "workload/%s", rbnutil_workload_name(workload_kinds[k]));
+    if(!is_enabled(name)) {
+      continue;
+    }
+    reset_instance();
+    rbnutil_workload workload;
+    rbnutil_workload_defaults(&workload, workload_kinds[k], 1, sample_rate);
+    workload.duration_ms = (uint32_t)((uint64_t)iterations * RBN_BLOCK_SAMPLES * 1000 / sample_rate) + 1;
+    const uint32_t event_count = rbnutil_workload_generate(&workload, &inst, NULL, 0);
+    rbn_event* events = malloc(event_count * sizeof(rbn_event));
+    if(!events) {
+      fprintf(stderr, "Couldn't allocate %u events for %s\n", event_count, name);
+      continue;
+    }
+    rbnutil_workload_generate(&workload, &inst, events, event_count);
+
+    memset(&counters, 0, sizeof(counters));
+    const uint64_t rendered_samples = inst.rendered_samples;
+    uint32_t e = 0;
+    for(uint32_t i = 0; i < iterations; i++) {
+      if(use_perf) {
+        rbnbench_perf_start();
+      }
+      const uint64_t start = get_time_ns();
+      for(; e < event_count && events[e].sample < inst.sample_index + RBN_BLOCK_SAMPLES; e++) {
+        rbn_send_msg(&inst, events[e].msg);
+      }
+      render_blocks(1);
+      const uint64_t end = get_time_ns();
+      if(use_perf) {
+        rbnbench_perf_stop(&counters);
+      }
+      values[i] = (double)(end - start);
+    }
+    report_counters(name, "ns/block", iterations, iterations, inst.rendered_samples - rendered_samples);
+    free(events);
+  }
+}
+
+// Builds a stream from random channel messages interleaved with everything the parser has to skip,
+// keeping the messages it should produce
+static size_t generate_stream(uint32_t* seed, uint8_t* bytes, rbn_msg* expected, uint32_t* expected_count) {
+  size_t size = 0;
+  uint8_t running_status = 0;
+  *expected_count = 0;
+#define PUT(byte) do { \
+    if(next_random(seed) % 8 == 0) bytes[size++] = 0xf8 + next_random(seed) % 8; \
+    bytes[size++] = (byte); \
+  } while(0)
+  while(size < RBNBENCH_FUZZ_BYTES - 16) {
+    const uint32_t kind = next_random(seed) % 8;
+    if(kind == 0) { // SysEx
+      PUT(0xf0);
+      for(uint32_t i = next_random(seed) % 8; i > 0; i--) {
+        PUT(next_random(seed) % 128);
+      }
+      PUT(0xf7);
+      running_status = 0;
+    } else if(kind == 1) { // System common
+      static const uint8_t statuses[] = {0xf1, 0xf2, 0xf3, 0xf6};
+      const uint8_t status = statuses[next_random(seed) % 4];
+      PUT(status);
+      for(uint32_t i = status == 0xf2 ? 2 : status == 0xf6 ? 0 : 1; i > 0; i--) {
+        PUT(next_random(seed) % 128);
+      }
+      running_status = 0;
+    } else {
+      const uint8_t status = (uint8_t)(0x80 + ((next_random(seed) % 7) << 4) + next_random(seed) % 16);
+      if(status != running_status || next_random(seed) % 2) {
+        PUT(status);
+        running_status = status;
+      }
+      rbn_msg* msg = expected + (*expected_count)++;
+      msg->channel = status & 0x0f;
+      msg->type = status & 0xf0;
+      msg->u8[2] = next_random(seed) % 128;
+      msg->u8[3] = data_length(status) > 1 ? next_random(seed) % 128 : 0;
+      PUT(msg->u8[2]);
+      if(data_length(status) > 1) {
+        PUT(msg->u8[3]);
+      }
+    }
+  }
+#undef PUT
+  return size;
+}
+
+// Feeds the bytes to an instance in chunks of random sizes, rendering in between
+static int send_in_chunks(uint32_t* seed, const uint8_t* bytes, size_t size) {
+  float samples[RBN_BLOCK_SAMPLES * 2];
+  size_t offset = 0;
+  while(offset < size) {
+    size_t chunk = 1 + next_random(seed) % 32;
+    if(chunk > size - offset) {
+      chunk = size - offset;
+    }
+    rbn_send_bytes(&inst, bytes + offset, chunk);
+    offset += chunk;
+
+    rbn_output_config output_config = {
+      .left_buffer = samples,
+      .right_buffer = samples + 1,
+      .stride = 2,
+      .sample_count = RBN_BLOCK_SAMPLES,
+      .sample_format = rbn_f32,
+    };
+    rbn_render(&inst, &output_config);
+    for(uintptr_t i = 0; i < RBN_BLOCK_SAMPLES * 2; i++) {
+      if(!(samples[i] >= -1.f && samples[i] <= 1.f)) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Checks rbn_parse_byte against generated streams with known messages, then random bytes for
+// invariants, and that rbn_send_bytes carries its state across buffers
+static int fuzz() {
+  static uint8_t bytes[RBNBENCH_FUZZ_BYTES];
+  static rbn_msg expected[RBNBENCH_FUZZ_BYTES];
+  uint32_t seed = 1;
+  uint64_t message_count = 0;
+  uint32_t failures = 0;
+  for(uint32_t i = 0; i < iterations; i++) {
+    uint32_t expected_count;
+    size_t size = generate_stream(&seed, bytes, expected, &expected_count);
+    if(i % 2) { // Random bytes, only checked for well-formed output
+      for(size_t j = 0; j < size; j++) {
+        bytes[j] = (uint8_t)next_random(&seed);
+      }
+      expected_count = UINT32_MAX;
+    }
+
+    rbn_parser parser = {0};
+    rbn_msg msg;
+    uint32_t count = 0;
+    int failed = 0;
+    for(size_t j = 0; j < size; j++) {
+      if(!rbn_parse_byte(&parser, bytes[j], &msg)) {
+        continue;
+      }
+      const int valid = msg.channel < 16 && msg.type >= rbn_note_off && msg.type <= rbn_pitch_bend && (msg.type & 0x0f) == 0 &&
+        msg.u8[2] < 0x80 && msg.u8[3] < 0x80 && (data_length(msg.type) > 1 || msg.u8[3] == 0);
+      if(!valid || (expected_count != UINT32_MAX && (count >= expected_count || msg.u32 != expected[count].u32))) {
+        failed = 1;
+      }
+      count++;
+    }
+    if(expected_count != UINT32_MAX && count != expected_count) {
+      failed = 1;
+    }
+    message_count += count;
+
+    reset_instance();
+    if(send_in_chunks(&seed, bytes, size) != 0 || memcmp(&inst.parser, &parser, sizeof(parser)) != 0) {
+      failed = 1;
+    }
+
+    if(failed) {
+      fprintf(stderr, "Stream %u failed\n", i);
+      failures++;
+    }
+  }
+
+  printf("{\n  \"fuzz\": {\"streams\": %u, \"messages\": %" PRIu64 ", \"failures\": %u}\n}\n", iterations, message_count, failures);
+  return failures > 0 ? -1 : 0;
+}
+
+// Renders the fuzz streams as raw bytes then as a sequence of their messages, then each stress workload
+static void render_streams(void* data) {
+  static uint8_t bytes[RBNBENCH_FUZZ_BYTES];
+  static rbn_msg msgs[RBNBENCH_FUZZ_BYTES];
+  static rbn_event events[RBNBENCH_FUZZ_BYTES];
+  static rbn_event workload_events[RBNBENCH_WORKLOAD_EVENTS];
+  static int16_t samples[RBNBENCH_FUZZ_BYTES * RBN_BLOCK_SAMPLES * 2];
+  uint32_t seed = 1;
+  for(uint32_t i = 0; i < iterations; i++) {
+    uint32_t msg_count;
+    const size_t size = generate_stream(&seed, bytes, msgs, &msg_count);
+    for(uint32_t j = 0; j < msg_count; j++) {
+      events[j].sample = j * RBN_BLOCK_SAMPLES / 2;
+      events[j].msg = msgs[j];
+    }
+    rbn_sequence_output output = {
+      .buffer = {
+        .left_buffer = samples,
+        .right_buffer = samples + 1,
+        .stride = 2,
+        .sample_count = (uint64_t)msg_count * RBN_BLOCK_SAMPLES,
+        .sample_format = rbn_s16,
+      },
+      .sample_count = (uint64_t)msg_count * RBN_BLOCK_SAMPLES,
+    };
+
+    rbn_reset(&inst);
+    send_in_chunks(&seed, bytes, size);
+    rbn_render_sequence(&inst, events, msg_count, &output);
+    rbn_stop_all_notes(&inst);
+  }
+
+  for(uintptr_t k = 0; k < sizeof(workload_kinds) / sizeof(*workload_kinds); k++) {
+    rbnutil_workload workload;
+    rbnutil_workload_defaults(&workload, workload_kinds[k], 1, sample_rate);
+    workload.duration_ms = RBNBENCH_WORKLOAD_MS;
+    uint32_t event_count = rbnutil_workload_generate(&workload, &inst, workload_events, RBNBENCH_WORKLOAD_EVENTS);
+    if(event_count > RBNBENCH_WORKLOAD_EVENTS) {
+      event_count = RBNBENCH_WORKLOAD_EVENTS;
+    }
+    rbn_sequence_output output = {
+      .buffer = {
+        .left_buffer = samples,
+        .right_buffer = samples + 1,
+        .stride = 2,
+        .sample_count = RBNBENCH_WORKLOAD_MS * sample_rate / 1000,
+        .sample_format = rbn_s16,
+      },
+      .sample_count = RBNBENCH_WORKLOAD_MS * sample_rate / 1000,
+    };
+
+    rbn_reset(&inst);
+    rbn_render_sequence(&inst, workload_events, event_count, &output);
+    rbn_stop_all_notes(&inst);
+  }
+}
+
+// Fails if rendering the streams, with one-shots and the attack cache in use, allocates, locks or
+// makes any system call
+static int check_realtime() {
+  if(rbnbench_rt_open() != 0) {
+    return -1;
+  }
+
+  reset_instance();
+  const size_t oneshot_size = rbn_oneshot_size(&inst, 4);
+  void* oneshot_memory = malloc(oneshot_size);
+  rbn_oneshot_init(&inst, oneshot_memory, oneshot_size, 4);
+  const size_t attack_size = 64 * rbn_attack_cache_slot_size(&inst, 0.25f);
+  void* attack_memory = malloc(attack_size);
+  rbn_attack_cache_init(&inst, attack_memory, attack_size, 0.25f);
+
+  uint64_t counts[rbnbench_max_calls] = {0};
+  const int result = rbnbench_rt_run(render_streams, NULL, counts);
+
+  rbn_attack_cache_init(&inst, NULL, 0, 0.f);
+  free(attack_memory);
+  rbn_refresh(&inst);
+  free(oneshot_memory);
+
+  if(result != 0) {
+    return -1;
+  }
+
+  uint64_t violations = 0;
+  printf("{\n  \"realtime\": {\"streams\": %u, \"workloads\": %u", iterations, (uint32_t)(sizeof(workload_kinds) / sizeof(*workload_kinds)));
+  for(uint32_t i = 0; i < rbnbench_max_calls; i++) {
+    printf(", \"%s\": %" PRIu64, rbnbench_rt_name(i), counts[i]);
+    violations += counts[i];
+  }
+  printf("}\n}\n");
+  return violations > 0 ? -1 : 0;
+}
+
+typedef struct instance_job {
+  rbn_instance inst;
+  uint32_t seed;
+  float samples[RBNBENCH_INSTANCE_SAMPLES * 2];
+} instance_job;
+
+// Random notes and program changes on every channel, the keymap one included for noisy programs
+static void render_job(instance_job* job) {
+  rbn_event events[RBNBENCH_INSTANCE_EVENTS];
+  uint32_t seed = job->seed;
+  for(uint32_t i = 0; i < RBNBENCH_INSTANCE_EVENTS; i++) {
+    rbn_event* event = events + i;
+    static const uint8_t types[4] = {rbn_note_on, rbn_note_on, rbn_note_off, rbn_program_change};
+    event->sample = i * (RBNBENCH_INSTANCE_SAMPLES / RBNBENCH_INSTANCE_EVENTS);
+    event->msg.channel = next_random(&seed) % 16;
+    event->msg.type = types[next_random(&seed) % 4];
+    event->msg.u8[2] = next_random(&seed) % 128;
+    event->msg.u8[3] = 1 + next_random(&seed) % 127;
+  }
+
+  memcpy(&job->inst, &base_inst, sizeof(rbn_instance));
+  job->inst.config.seed = job->seed;
+  rbn_reset(&job->inst);
+
+  rbn_sequence_output output = {
+    .buffer = {
+      .left_buffer = job->samples,
+      .right_buffer = job->samples + 1,
+      .stride = 2,
+      .sample_count = RBNBENCH_INSTANCE_SAMPLES,
+      .sample_format = rbn_f32,
+    },
+    .sample_count = RBNBENCH_INSTANCE_SAMPLES,
+  };
+  rbn_render_sequence(&job->inst, events, RBNBENCH_INSTANCE_EVENTS, &output);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI job_thread(LPVOID data) {
+  render_job(data);
+  return 0;
+}
+#else
+static void* job_thread(void* data) {
+  render_job(data);
+  return NULL;
+}
+#endif
+
+// Renders a different sequence on each instance from its own thread, then again one after the
+// other, and checks that the outputs match, which they only do if instances share no state
+static int check_instances() {
+  static instance_job jobs[2][RBNBENCH_INSTANCE_COUNT];
+  for(uint32_t i = 0; i < RBNBENCH_INSTANCE_COUNT; i++) {
+    jobs[0][i].seed = jobs[1][i].seed = i + 1;
+  }
+
+  const uint64_t start = get_time_ns();
+#ifdef _WIN32
+  HANDLE threads[RBNBENCH_INSTANCE_COUNT];
+  for(uint32_t i = 0; i < RBNBENCH_INSTANCE_COUNT; i++) {
+    threads[i] = CreateThread(NULL, 0, job_thread, jobs[0] + i, 0, NULL);
+  }
+  WaitForMultipleObjects(RBNBENCH_INSTANCE_COUNT, threads, TRUE, INFINITE);
+  for(uint32_t i = 0; i < RBNBENCH_INSTANCE_COUNT; i++) {
+    CloseHandle(threads[i]);
+  }
+#else
+  pthread_t threads[RBNBENCH_INSTANCE_COUNT];
+  for(uint32_t i = 0; i < RBNBENCH_INSTANCE_COUNT; i++) {
+    pthread_create(threads + i, NULL, job_thread, jobs[0] + i);
+  }
+  for(uint32_t i = 0; i < RBNBENCH_INSTANCE_COUNT; i++) {
+    pthread_join(threads[i], NULL);
+  }
+#endif
+  const uint64_t parallel_time = get_time_ns() - start;
+
+  for(uint32_t i = 0; i < RBNBENCH_INSTANCE_COUNT; i++) {
+    render_job(jobs[1] + i);
+  }
+  const uint64_t serial_time = get_time_ns() - start - parallel_time;
+
+  uint32_t mismatches = 0;
+  for(uint32_t i = 0; i < RBNBENCH_INSTANCE_COUNT; i++) {
+    if(memcmp(jobs[0][i].samples, jobs[1][i].samples, sizeof(jobs[0][i].samples)) != 0) {
+      fprintf(stderr, "Instance %u differs from its serial render\n", i);
+      mismatches++;
+    }
+  }
+
+  printf("{\n  \"instances\": {\"count\": %u, \"samples\": %u, \"mismatches\": %u, \"parallel_ms\": %.3f, \"serial_ms\": %.3f}\n}\n",
+    RBNBENCH_INSTANCE_COUNT, RBNBENCH_INSTANCE_SAMPLES, mismatches, parallel_time / 1e6, serial_time / 1e6);
+  return mismatches > 0 ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+  int run_fuzz = 0;
+  int run_instances = 0;
+  int run_realtime = 0;
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-n") && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+      if(iterations < 1 || iterations > RBNBENCH_MAX_ITERATIONS) {
+        fprintf(stderr, "Iterations must be between 1 and %d\n", RBNBENCH_MAX_ITERATIONS);
+        return -1;
+      }
+    } else if(!strcmp(argv[i], "-perf")) {
+      use_perf = 1;
+    } else if(!strcmp(argv[i], "-fuzz")) {
+      run_fuzz = 1;
+    } else if(!strcmp(argv[i], "-instances")) {
+      run_instances = 1;
+    } else if(!strcmp(argv[i], "-realtime")) {
+      run_realtime = 1;
+    } else if(!filter) {
+      filter = argv[i];
+    } else {
+      fprintf(stderr, "rbnbench [filter] [-n iterations] [-perf] [-fuzz] [-instances] [-realtime]\n");
+      return -1;
+    }
+  }
+
+  rbn_config config = {
+    .sample_rate = sample_rate,
+  };
+  rbn_general_init(&base_inst, &config);
+
+  if(run_fuzz) {
+    return fuzz();
+  }
+  if(run_instances) {
+    return check_instances();
+  }
+  if(run_realtime) {
+    return check_realtime();
+  }
+
+  // Falls back to wall-clock only results
+  if(use_perf && rbnbench_perf_open() != 0) {
+    use_perf = 0;
+  }
+
+  printf("{\n  \"sample_rate\": %u,\n  \"block_samples\": %u,\n  \"voice_count\": %u,\n  \"perf\": %s,\n  \"results\": [",
+    sample_rate, RBN_BLOCK_SAMPLES, RBN_VOICE_COUNT, use_perf ? "true" : "false");
+
+  bench_programs();
+  bench_operators();
+  bench_voices();
+  bench_keymap();
+  bench_attack();
+  bench_events();
+  bench_bytes();
+  bench_output();
+  bench_workloads();
+
+  printf("\n  ]\n}\n");
+
+  if(use_perf) {
+    rbnbench_perf_close();
+  }
+
+  return 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum rbnbench_counter {
+  rbnbench_cycles,
+  rbnbench_instructions,
+  rbnbench_branch_misses,
+  rbnbench_l1d_misses,
+  rbnbench_llc_misses,
+  rbnbench_max_counters,
+} rbnbench_counter;
+
+typedef struct rbnbench_counters {
+  uint64_t values[rbnbench_max_counters];
+  uint32_t available_mask; // Counters that could be opened on this machine
+} rbnbench_counters;
+
+int rbnbench_perf_open();
+void rbnbench_perf_close();
+void rbnbench_perf_start();
+void rbnbench_perf_stop(rbnbench_counters* counters);
+const char* rbnbench_perf_name(rbnbench_counter counter);
+
+typedef enum rbnbench_call {
+  rbnbench_allocations,
+  rbnbench_frees,
+  rbnbench_locks, // Mutexes and semaphores
+  rbnbench_syscalls,
+  rbnbench_max_calls,
+} rbnbench_call;
+
+// Runs func on a thread of its own, counting the calls real-time code must not make
+int rbnbench_rt_open();
+int rbnbench_rt_run(void (*func)(void*), void* data, uint64_t* counts);
+const char* rbnbench_rt_name(rbnbench_call call);
@@ -0,0 +1,117 @@
+#include "rbnbench.h"
+
+#include <stdio.h>
+
+static const char* counter_names[rbnbench_max_counters] = {
+  "cycles",
+  "instructions",
+  "branch_misses",
+  "l1d_misses",
+  "llc_misses",
+};
+
+const char* rbnbench_perf_name(rbnbench_counter counter) {
+  return counter_names[counter];
+}
+
+#ifdef __linux__
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int fds[rbnbench_max_counters] = {-1, -1, -1, -1, -1};
+static int group_fd = -1;
+
+static int open_counter(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = group_fd < 0; // Members follow the leader
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+int rbnbench_perf_open() {
+  static const uint64_t cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  static const struct {
+    uint32_t type;
+    uint64_t config;
+  } events[rbnbench_max_counters] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_read_miss},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_read_miss},
+  };
+
+  // Grouped so all counters cover the exact same instructions, members the PMU lacks are skipped
+  for(uint32_t i = 0; i < rbnbench_max_counters; i++) {
+    fds[i] = open_counter(events[i].type, events[i].config);
+    if(fds[i] >= 0 && group_fd < 0) {
+      group_fd = fds[i];
+    }
+  }
+
+  if(group_fd < 0) {
+    fprintf(stderr, "Hardware performance counters unavailable (check /proc/sys/kernel/perf_event_paranoid)\n");
+    return -1;
+  }
+  return 0;
+}
+
+void rbnbench_perf_close() {
+  for(uint32_t i = 0; i < rbnbench_max_counters; i++) {
+    if(fds[i] >= 0) {
+      close(fds[i]);
+      fds[i] = -1;
+    }
+  }
+  group_fd = -1;
+}
+
+void rbnbench_perf_start() {
+  if(group_fd >= 0) {
+    ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+}
+
+void rbnbench_perf_stop(rbnbench_counters* counters) {
+  if(group_fd < 0) {
+    return;
+  }
+  ioctl(group_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  for(uint32_t i = 0; i < rbnbench_max_counters; i++) {
+    uint64_t data[3]; // Value, time enabled, time running
+    if(fds[i] >= 0 && read(fds[i], data, sizeof(data)) == sizeof(data) && data[2] > 0) {
+      // Scale up in case the kernel had to multiplex counters
+      counters->values[i] += data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+      counters->available_mask |= 1 << i;
+    }
+  }
+}
+
+#else
+
+int rbnbench_perf_open() {
+  fprintf(stderr, "Hardware performance counters are only supported on Linux\n");
+  return -1;
+}
+
+void rbnbench_perf_close() {
+}
+
+void rbnbench_perf_start() {
+}
+
+void rbnbench_perf_stop(rbnbench_counters* counters) {
+}
+
+#endif
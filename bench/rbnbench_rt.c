@@ -0,0 +1,198 @@
+#ifdef __linux__
+#define _GNU_SOURCE // RTLD_NEXT, __GLIBC__ is only known after including a header
+#endif
+
+#include "rbnbench.h"
+
+#include <stdio.h>
+
+static const char* call_names[rbnbench_max_calls] = {
+  "allocations",
+  "frees",
+  "locks",
+  "syscalls",
+};
+
+const char* rbnbench_rt_name(rbnbench_call call) {
+  return call_names[call];
+}
+
+#if defined(__linux__) && defined(__GLIBC__)
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+
+// The allocator is replaced for the whole program, forwarding to glibc's own entry points, while
+// locking functions are looked up past this executable before anything is checked
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+
+static int (*next_mutex_lock)(pthread_mutex_t*);
+static int (*next_mutex_trylock)(pthread_mutex_t*);
+static int (*next_sem_wait)(sem_t*);
+
+static __thread int checking; // Only the thread under test is checked
+static uint64_t call_counts[rbnbench_max_calls];
+
+static void count_call(rbnbench_call call) {
+  if(checking) {
+    __atomic_fetch_add(call_counts + call, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void* malloc(size_t size) {
+  count_call(rbnbench_allocations);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  count_call(rbnbench_allocations);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  count_call(rbnbench_allocations);
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+  count_call(rbnbench_frees);
+  __libc_free(ptr);
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex) {
+  count_call(rbnbench_locks);
+  return next_mutex_lock(mutex);
+}
+
+int pthread_mutex_trylock(pthread_mutex_t* mutex) {
+  count_call(rbnbench_locks);
+  return next_mutex_trylock(mutex);
+}
+
+int sem_wait(sem_t* sem) {
+  count_call(rbnbench_locks);
+  return next_sem_wait(sem);
+}
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define RBNBENCH_SECCOMP
+
+// Trapped system calls are skipped and fail, which is fine since any of them is already a failure
+static void on_sigsys(int signal, siginfo_t* info, void* context) {
+  count_call(rbnbench_syscalls);
+  ucontext_t* ucontext = context;
+#ifdef __x86_64__
+  ucontext->uc_mcontext.gregs[REG_RAX] = -ENOSYS;
+#else
+  ucontext->uc_mcontext.regs[0] = -ENOSYS;
+#endif
+}
+
+// Filters cannot be removed, so the thread keeps the few calls it needs to return from the handler
+// and to exit once done
+static int trap_syscalls() {
+  struct sock_filter filter[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_rt_sigreturn, 6, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_rt_sigprocmask, 5, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_madvise, 4, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_munmap, 3, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_futex, 2, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_exit, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRAP),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+  };
+  struct sock_fprog program = {
+    .len = sizeof(filter) / sizeof(*filter),
+    .filter = filter,
+  };
+  if(prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) {
+    return -1;
+  }
+  return prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program) == 0 ? 0 : -1;
+}
+#endif
+
+typedef struct checked_job {
+  void (*func)(void*);
+  void* data;
+  int trapping;
+} checked_job;
+
+static void* checked_thread(void* data) {
+  checked_job* job = data;
+#ifdef RBNBENCH_SECCOMP
+  job->trapping = trap_syscalls() == 0;
+#endif
+  checking = 1;
+  job->func(job->data);
+  checking = 0;
+  return NULL;
+}
+
+int rbnbench_rt_open() {
+  next_mutex_lock = (int (*)(pthread_mutex_t*))dlsym(RTLD_NEXT, "pthread_mutex_lock");
+  next_mutex_trylock = (int (*)(pthread_mutex_t*))dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+  next_sem_wait = (int (*)(sem_t*))dlsym(RTLD_NEXT, "sem_wait");
+  if(!next_mutex_lock || !next_mutex_trylock || !next_sem_wait) {
+    fprintf(stderr, "Couldn't find the functions to intercept\n");
+    return -1;
+  }
+  return 0;
+}
+
+int rbnbench_rt_run(void (*func)(void*), void* data, uint64_t* counts) {
+#ifdef RBNBENCH_SECCOMP
+  struct sigaction action;
+  struct sigaction previous_action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = on_sigsys;
+  action.sa_flags = SA_SIGINFO;
+  sigaction(SIGSYS, &action, &previous_action);
+#endif
+
+  checked_job job = {.func = func, .data = data};
+  pthread_t thread;
+  if(pthread_create(&thread, NULL, checked_thread, &job) != 0) {
+    return -1;
+  }
+  pthread_join(thread, NULL);
+
+#ifdef RBNBENCH_SECCOMP
+  sigaction(SIGSYS, &previous_action, NULL);
+#endif
+  if(!job.trapping) {
+    fprintf(stderr, "System calls are not checked, seccomp is unavailable\n");
+  }
+  for(uint32_t i = 0; i < rbnbench_max_calls; i++) {
+    counts[i] += call_counts[i];
+    call_counts[i] = 0;
+  }
+  return 0;
+}
+
+#else
+
+int rbnbench_rt_open() {
+  fprintf(stderr, "Real-time safety checks are only supported on Linux with glibc\n");
+  return -1;
+}
+
+int rbnbench_rt_run(void (*func)(void*), void* data, uint64_t* counts) {
+  return -1;
+}
+
+#endif
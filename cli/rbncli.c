@@ -4,9 +4,11 @@
 #define MA_NO_DECODING
 #include "miniaudio.h"
 
-#define TML_IMPLEMENTATION
-#define TML_ERROR(str) printf("%s\n", str);
-#include "tml.h"
+#define RBN_TRACE_BLOCK_BEGIN(inst) do { if(rbncli_tracing) rbncli_trace_block_begin((inst)->sample_index); } while(0)
+#define RBN_TRACE_BLOCK_END(inst) do { if(rbncli_tracing) rbncli_trace_block_end(); } while(0)
+#define RBN_TRACE_VOICE_BEGIN(inst, voice) do { if(rbncli_tracing) rbncli_trace_voice_begin(); } while(0)
+#define RBN_TRACE_VOICE_END(inst, voice) do { if(rbncli_tracing) rbncli_trace_voice_end((uint8_t)((voice)->program - (inst)->programs), (voice)->key, (voice)->channel); } while(0)
+#define RBN_TRACE_MSG(inst, msg) do { if(rbncli_tracing) rbncli_trace_msg(msg); } while(0)
 
 #define RBN_IMPLEMENTATION
 #define RBN_GENERAL_IMPLEMENTATION
@@ -17,9 +19,12 @@ rbn_instance inst = {0};
 int rbncli_print_help(int argc, char** argv) {
   printf(
     "rbncli v0.1\n"
-    "- play [file.mid]\n"
-    "- render [file.mid|demo]\n"
-    "- open [device_id]\n"
+    "- play [file.mid] [channel] [-monitor] [-ahead ms] [-trace trace.json]\n"
+    "- render [file.mid|demo|stress] [channel] [-o out.wav|-] [-raw] [-stems|-incremental|-normalize] [-oneshots variations] [-attack-cache MiB] [-no-cache] [-trace trace.json]\n"
+    "    [-workload all|polyphony,retrigger,bend,percussion,controls] [-seed n] [-duration seconds]\n"
+    "- open [device_id|midi_stream|-]\n"
+    "- serve [socket] [-workers count]\n"
+    "- loadtest [socket] [file.mid] [-clients count] [-jobs count]\n"
     "- edit [prg_id]\n"
     "- export [prg_id]\n"
     "- exit\n"
@@ -36,6 +41,10 @@ static int handle_cmd(int argc, char** argv) {
     return rbncli_render_mid(argc - 1, argv + 1);
   } else if(argc >= 1 && !strcmp(argv[0], "open")) {
     return rbncli_open_device(argc - 1, argv + 1);
+  } else if(argc >= 2 && !strcmp(argv[0], "serve")) {
+    return rbncli_serve(argc - 1, argv + 1);
+  } else if(argc >= 3 && !strcmp(argv[0], "loadtest")) {
+    return rbncli_loadtest(argc - 1, argv + 1);
   } else if(argc >= 1 && !strcmp(argv[0], "edit")) {
     return rbncli_edit_prg(argc - 1, argv + 1);
   } else if(argc >= 1 && !strcmp(argv[0], "export")) {
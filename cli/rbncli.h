@@ -3,33 +3,161 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <limits.h>
 
 #include "miniaudio.h"
-struct tsf_stream;
-#include "tml.h"
+
+#define RBN_STATS
+#define RBN_STEMS
+#define RBN_ATTACK_CACHE
 #include "../robin_general.h"
 
 #define RBNCLI_SUCCESS 0
 #define RBNCLI_ERR_EXIT -2
 #define RBNCLI_ERR_UNKNOWN -1
 
+#ifdef PATH_MAX
+#define RBNCLI_PATH_MAX PATH_MAX
+#else
+#define RBNCLI_PATH_MAX 260 // MAX_PATH on Windows
+#endif
+
+// Accesses to 64-bit state shared between threads, available whether robin has RBN_STATS or not
+#if defined(__GNUC__) || defined(__clang__)
+#define RBNCLI_LOAD(src) __atomic_load_n(&(src), __ATOMIC_RELAXED)
+#define RBNCLI_STORE(dst, value) __atomic_store_n(&(dst), (value), __ATOMIC_RELAXED)
+#define RBNCLI_LOAD_ACQUIRE(src) __atomic_load_n(&(src), __ATOMIC_ACQUIRE)
+#define RBNCLI_STORE_RELEASE(dst, value) __atomic_store_n(&(dst), (value), __ATOMIC_RELEASE)
+#define RBNCLI_TRY_LOCK(flag) (__atomic_exchange_n(&(flag), 1, __ATOMIC_ACQUIRE) == 0)
+#define RBNCLI_UNLOCK(flag) __atomic_store_n(&(flag), 0, __ATOMIC_RELEASE)
+#else // Volatile accesses have acquire and release semantics with MSVC
+#include <intrin.h>
+#define RBNCLI_LOAD(src) (*(volatile const uint64_t*)&(src))
+#define RBNCLI_STORE(dst, value) (*(volatile uint64_t*)&(dst) = (value))
+#define RBNCLI_LOAD_ACQUIRE(src) RBNCLI_LOAD(src)
+#define RBNCLI_STORE_RELEASE(dst, value) RBNCLI_STORE(dst, value)
+#define RBNCLI_TRY_LOCK(flag) (_InterlockedExchange(&(flag), 1) == 0)
+#define RBNCLI_UNLOCK(flag) (*(volatile long*)&(flag) = 0)
+#endif
+
+// For counters with a single writer, where read-modify-write does not need to be atomic
+#define RBNCLI_ADD(dst, value) RBNCLI_STORE(dst, (dst) + (value))
+
 static const uint32_t sample_rate = 44100;
 extern rbn_instance inst;
 
+#define RBNCLI_LOAD_BUCKETS 201 // One per percent of the deadline, the last one counts everything above
+
+// Audio callback timings against the duration of the audio they render
+typedef struct rbncli_deadline_stats {
+  uint64_t callbacks;
+  uint64_t overruns;
+  uint64_t max_time; // In nanoseconds
+  uint64_t max_time_deadline;
+  uint64_t load_histogram[RBNCLI_LOAD_BUCKETS];
+} rbncli_deadline_stats;
+
+typedef struct rbncli_wav rbncli_wav;
+
+typedef struct rbncli_file {
+  char name[256];
+  uint64_t size;
+  uint64_t time; // Last modification, only comparable with other files
+} rbncli_file;
+typedef struct rbncli_midi rbncli_midi;
+
+// Event positions are absolute, with the tempo map applied
+typedef struct rbncli_timeline {
+  rbn_event* events;
+  uint32_t event_count;
+  uint32_t sample_count; // Position of the last event
+  const void* mapping; // Set when events live in a mapped cache file
+  size_t mapping_size;
+} rbncli_timeline;
+
+// Pre-parsed events keyed by the source file's hash and the sample rate
+typedef struct rbncli_cache {
+  char path[512]; // Empty when the cache directory or file can't be used
+  FILE* file;
+  uint64_t source_hash;
+  uint32_t sample_rate;
+  uint32_t event_count;
+  uint32_t sample_count;
+} rbncli_cache;
+
 int rbncli_play_mid(int argc, char** argv);
 int rbncli_render_mid(int argc, char** argv);
 int rbncli_open_device(int argc, char** argv);
 int rbncli_edit_prg(int argc, char** argv);
 int rbncli_export_prg(int argc, char** argv);
+int rbncli_serve(int argc, char** argv);
+int rbncli_loadtest(int argc, char** argv);
 int rbncli_print_help(int argc, char** argv);
 
+rbncli_midi* rbncli_midi_open_memory(const uint8_t* data, size_t size, uint32_t sample_rate);
+rbncli_midi* rbncli_midi_open_file(const char* filename, uint32_t sample_rate);
+int rbncli_midi_next(rbncli_midi* midi, rbn_event* event);
+uint32_t rbncli_midi_get_progress(const rbncli_midi* midi);
+void rbncli_midi_close(rbncli_midi* midi);
+
+int rbncli_timeline_load_memory(rbncli_timeline* timeline, const uint8_t* data, size_t size, uint32_t sample_rate);
+int rbncli_timeline_load_file(rbncli_timeline* timeline, const char* filename, uint32_t sample_rate);
+void rbncli_timeline_free(rbncli_timeline* timeline);
+
+uint64_t rbncli_hash(const void* data, size_t size);
+uint64_t rbncli_hash_continue(uint64_t hash, const void* data, size_t size);
+int rbncli_cache_lookup(rbncli_cache* cache, rbncli_timeline* timeline, const void* data, size_t size, uint32_t sample_rate);
+void rbncli_cache_begin(rbncli_cache* cache);
+void rbncli_cache_add(rbncli_cache* cache, const rbn_event* event);
+void rbncli_cache_end(rbncli_cache* cache);
+void rbncli_cache_cancel(rbncli_cache* cache);
+
+rbncli_wav* rbncli_wav_open(const char* filename, int raw);
+int16_t* rbncli_wav_get_buffer(rbncli_wav* wav, uint32_t* frame_count);
+void rbncli_wav_commit(rbncli_wav* wav, uint32_t frame_count);
+uint64_t rbncli_wav_get_stall_time(const rbncli_wav* wav);
+int rbncli_wav_close(rbncli_wav* wav);
+
+// Mixes per-channel stems, only rendering those not found in the cache directory
+int rbncli_render_incremental(const rbn_event* events, uint32_t event_count, uint32_t sample_count, rbncli_wav* wav, FILE* log);
+
+// Checked by the hooks compiled into robin, so that they cost a branch when not tracing
+extern int rbncli_tracing;
+int rbncli_trace_begin(const char* filename);
+void rbncli_trace_block_begin(uint64_t sample_index);
+void rbncli_trace_block_end();
+void rbncli_trace_voice_begin();
+void rbncli_trace_voice_end(uint8_t program, uint8_t key, uint8_t channel);
+void rbncli_trace_msg(rbn_msg msg);
+int rbncli_trace_end();
+
 void rbncli_platform_init();
-int rbncli_init_ma_device(ma_device* device);
-void rbncli_send_tml_msg(rbn_instance* inst, tml_message* tml_msg);
+void rbncli_set_binary_mode(FILE* file);
+const void* rbncli_map_file(const char* filename, size_t* size);
+void rbncli_unmap_file(const void* data, size_t size);
+int rbncli_get_cache_dir(char* path, size_t size);
+// Files of a directory with the given extension, in an array to free, or null if it can't be read or listed
+rbncli_file* rbncli_list_files(const char* dir, const char* extension, uint32_t* count);
+void rbncli_touch_file(const char* path); // Updates the modification time
+// Without a render function, the device renders the global instance with the lock held
+typedef void (*rbncli_render_func)(int16_t* output, uint32_t frame_count, void* data);
+int rbncli_init_ma_device(ma_device* device, rbncli_render_func render, void* data);
+void rbncli_send_msg(rbn_instance* inst, rbn_msg msg);
+void rbncli_get_deadline_stats(rbncli_deadline_stats* stats);
+uint32_t rbncli_get_load_percentile(const rbncli_deadline_stats* stats, uint32_t percentile);
+void rbncli_print_deadline_stats(FILE* file, const rbncli_deadline_stats* stats);
 uint64_t rbncli_get_time();
+uint64_t rbncli_get_time_ns();
 void rbncli_progress_bar(uint32_t current, uint32_t* last);
+void rbncli_print_stats(FILE* file, const rbn_instance* inst);
 void rbncli_sleep(uint32_t ms);
 void rbncli_lock();
 void rbncli_unlock();
+void* rbncli_create_thread(void (*func)(void*), void* data);
+void rbncli_join_thread(void* thread);
+void* rbncli_create_semaphore(uint32_t count);
+void rbncli_wait_semaphore(void* semaphore);
+void rbncli_post_semaphore(void* semaphore);
+void rbncli_destroy_semaphore(void* semaphore);
 void rbncli_clear_screen();
 int rbncli_getch();
@@ -0,0 +1,135 @@
+#include "rbncli.h"
+
+#include <string.h>
+
+#define RBNCLI_CACHE_MAGIC 0x454e4252 // "RBNE"
+#define RBNCLI_CACHE_VERSION 1
+
+// Native endianness, events follow immediately and stay 8-byte aligned
+typedef struct rbncli_cache_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t source_hash;
+  uint32_t sample_rate;
+  uint32_t event_count;
+  uint32_t sample_count;
+  uint32_t event_size;
+} rbncli_cache_header;
+
+uint64_t rbncli_hash(const void* data, size_t size) {
+  return rbncli_hash_continue(0xcbf29ce484222325, data, size);
+}
+
+uint64_t rbncli_hash_continue(uint64_t hash, const void* data, size_t size) {
+  // FNV-1a
+  const uint8_t* bytes = data;
+  for(size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3;
+  }
+  return hash;
+}
+
+int rbncli_cache_lookup(rbncli_cache* cache, rbncli_timeline* timeline, const void* data, size_t size, uint32_t sample_rate) {
+  memset(cache, 0, sizeof(*cache));
+  memset(timeline, 0, sizeof(*timeline));
+  cache->source_hash = rbncli_hash(data, size);
+  cache->sample_rate = sample_rate;
+
+  char dir[sizeof(cache->path) - 64];
+  if(rbncli_get_cache_dir(dir, sizeof(dir)) != 0) {
+    return -1;
+  }
+  snprintf(cache->path, sizeof(cache->path), "%s/%016" PRIx64 "-%u.rbne", dir, cache->source_hash, sample_rate);
+
+  size_t cache_size;
+  const uint8_t* cache_data = rbncli_map_file(cache->path, &cache_size);
+  if(!cache_data) {
+    return -1;
+  }
+
+  // Anything unexpected is treated as a miss and gets overwritten
+  const rbncli_cache_header* header = (const rbncli_cache_header*)cache_data;
+  if(cache_size < sizeof(rbncli_cache_header)
+    || header->magic != RBNCLI_CACHE_MAGIC
+    || header->version != RBNCLI_CACHE_VERSION
+    || header->source_hash != cache->source_hash
+    || header->sample_rate != sample_rate
+    || header->event_size != sizeof(rbn_event)
+    || header->event_count == 0
+    || cache_size != sizeof(rbncli_cache_header) + (size_t)header->event_count * sizeof(rbn_event)) {
+    rbncli_unmap_file(cache_data, cache_size);
+    return -1;
+  }
+
+  timeline->events = (rbn_event*)(cache_data + sizeof(rbncli_cache_header));
+  timeline->event_count = header->event_count;
+  timeline->sample_count = header->sample_count;
+  timeline->mapping = cache_data;
+  timeline->mapping_size = cache_size;
+  return 0;
+}
+
+void rbncli_cache_begin(rbncli_cache* cache) {
+  if(!cache->path[0]) {
+    return; // No cache directory
+  }
+
+  char tmp_path[sizeof(cache->path) + 4];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+  cache->file = fopen(tmp_path, "wb");
+  if(!cache->file) {
+    cache->path[0] = '\0'; // Reported as disabled
+    return;
+  }
+
+  // Header is rewritten once the event count is known
+  const rbncli_cache_header header = {0};
+  fwrite(&header, sizeof(header), 1, cache->file);
+}
+
+void rbncli_cache_add(rbncli_cache* cache, const rbn_event* event) {
+  if(cache->file) {
+    fwrite(event, sizeof(rbn_event), 1, cache->file);
+    cache->event_count++;
+    cache->sample_count = event->sample;
+  }
+}
+
+void rbncli_cache_end(rbncli_cache* cache) {
+  if(!cache->file) {
+    return;
+  }
+
+  const rbncli_cache_header header = {
+    .magic = RBNCLI_CACHE_MAGIC,
+    .version = RBNCLI_CACHE_VERSION,
+    .source_hash = cache->source_hash,
+    .sample_rate = cache->sample_rate,
+    .event_count = cache->event_count,
+    .sample_count = cache->sample_count,
+    .event_size = sizeof(rbn_event),
+  };
+  fseek(cache->file, 0, SEEK_SET);
+  const int written = fwrite(&header, sizeof(header), 1, cache->file) == 1;
+  const int closed = fclose(cache->file) == 0;
+  cache->file = NULL;
+
+  // Renaming last means readers never see a partial file
+  char tmp_path[sizeof(cache->path) + 4];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+  remove(cache->path);
+  if(!written || !closed || rename(tmp_path, cache->path) != 0) {
+    remove(tmp_path);
+  }
+}
+
+void rbncli_cache_cancel(rbncli_cache* cache) {
+  if(cache->file) {
+    fclose(cache->file);
+    cache->file = NULL;
+
+    char tmp_path[sizeof(cache->path) + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+    remove(tmp_path);
+  }
+}
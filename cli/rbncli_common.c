@@ -4,20 +4,82 @@
 #include <string.h>
 #include <assert.h>
 
-static void data_callback(ma_device* device, void* output, const void* input, ma_uint32 sample_count) {
+// Written by the audio callback only, and reset before the device starts
+static rbncli_deadline_stats deadline_stats;
+
+static rbncli_render_func device_render;
+static void* device_render_data;
+
+static void add_deadline_time(uint64_t time, uint64_t deadline) {
+  uint64_t load = deadline > 0 ? (time * 100) / deadline : 0;
+  if(load >= RBNCLI_LOAD_BUCKETS) {
+    load = RBNCLI_LOAD_BUCKETS - 1;
+  }
+  RBNCLI_ADD(deadline_stats.load_histogram[load], 1);
+  RBNCLI_ADD(deadline_stats.callbacks, 1);
+  if(time > deadline) {
+    RBNCLI_ADD(deadline_stats.overruns, 1);
+  }
+  if(time > deadline_stats.max_time) {
+    RBNCLI_STORE(deadline_stats.max_time, time);
+    RBNCLI_STORE(deadline_stats.max_time_deadline, deadline);
+  }
+}
+
+static void render_locked(int16_t* output, uint32_t frame_count, void* data) {
   rbncli_lock();
   rbn_output_config output_config = {
     .left_buffer = output,
-    .right_buffer = (int16_t*)output + 1,
+    .right_buffer = output + 1,
     .stride = 2,
-    .sample_count = sample_count,
+    .sample_count = frame_count,
     .sample_format = rbn_s16,
   };
   rbn_render(&inst, &output_config);
   rbncli_unlock();
 }
 
-int rbncli_init_ma_device(ma_device* device) {
+static void data_callback(ma_device* device, void* output, const void* input, ma_uint32 sample_count) {
+  // Waiting for a lock counts too, as it delays the audio all the same
+  const uint64_t start_time = rbncli_get_time_ns();
+  device_render(output, sample_count, device_render_data);
+  add_deadline_time(rbncli_get_time_ns() - start_time, ((uint64_t)sample_count * 1000000000) / device->sampleRate);
+}
+
+void rbncli_get_deadline_stats(rbncli_deadline_stats* stats) {
+  stats->callbacks = RBNCLI_LOAD(deadline_stats.callbacks);
+  stats->overruns = RBNCLI_LOAD(deadline_stats.overruns);
+  stats->max_time = RBNCLI_LOAD(deadline_stats.max_time);
+  stats->max_time_deadline = RBNCLI_LOAD(deadline_stats.max_time_deadline);
+  for(uintptr_t i = 0; i < RBNCLI_LOAD_BUCKETS; i++) {
+    stats->load_histogram[i] = RBNCLI_LOAD(deadline_stats.load_histogram[i]);
+  }
+}
+
+uint32_t rbncli_get_load_percentile(const rbncli_deadline_stats* stats, uint32_t percentile) {
+  const uint64_t target = (stats->callbacks * percentile + 99) / 100;
+  uint64_t count = 0;
+  for(uint32_t load = 0; load < RBNCLI_LOAD_BUCKETS; load++) {
+    count += stats->load_histogram[load];
+    if(count >= target && count > 0) {
+      return load;
+    }
+  }
+  return 0;
+}
+
+void rbncli_print_deadline_stats(FILE* file, const rbncli_deadline_stats* stats) {
+  fprintf(file, "Callbacks: %" PRIu64 "\n", stats->callbacks);
+  fprintf(file, "Deadline overruns: %" PRIu64 "\n", stats->overruns);
+  fprintf(file, "Callback load %% (p50, p99, max): %u, %u, %u\n", rbncli_get_load_percentile(stats, 50), rbncli_get_load_percentile(stats, 99), rbncli_get_load_percentile(stats, 100));
+  fprintf(file, "Slowest callback us: %.1f of %.1f\n", (double)stats->max_time / 1000.0, (double)stats->max_time_deadline / 1000.0);
+}
+
+int rbncli_init_ma_device(ma_device* device, rbncli_render_func render, void* data) {
+  memset(&deadline_stats, 0, sizeof(deadline_stats));
+  device_render = render ? render : render_locked;
+  device_render_data = data;
+
   ma_device_config device_config;
   device_config = ma_device_config_init(ma_device_type_playback);
   device_config.playback.format = ma_format_s16;
@@ -39,18 +101,7 @@ int rbncli_init_ma_device(ma_device* device) {
   return 0;
 }
 
-void rbncli_send_tml_msg(rbn_instance* inst, tml_message* tml_msg) {
-  rbn_msg msg;
-  msg.channel = tml_msg->channel;
-  msg.type = tml_msg->type;
-  msg.key = tml_msg->key;
-  msg.velocity = tml_msg->velocity;
-  if(tml_msg->type == TML_PITCH_BEND) {
-    // TML transforms pitch bend values as a 14 (in 16) bits integer but rbn expects actual MIDI bytes
-    // so we put back values as two separate 7 (in 8) bits integers
-    msg.u8[2] = tml_msg->pitch_bend & 0x7f;
-    msg.u8[3] = tml_msg->pitch_bend >> 7;
-  }
+void rbncli_send_msg(rbn_instance* inst, rbn_msg msg) {
   rbncli_lock();
   rbn_send_msg(inst, msg);
   rbncli_unlock();
@@ -68,3 +119,40 @@ void rbncli_progress_bar(uint32_t current, uint32_t* last) {
     }
   }
 }
+
+// Prints nothing when robin is built without RBN_STATS
+void rbncli_print_stats(FILE* file, const rbn_instance* inst) {
+#ifdef RBN_STATS
+  rbn_stats stats;
+  rbn_get_stats(inst, &stats);
+
+  const char* message_names[8] = {"note off", "note on", "key pressure", "control change", "program change", "channel pressure", "pitch bend", "other"};
+  for(uintptr_t i = 0; i < 8; i++) {
+    if(stats.messages[i] > 0) {
+      fprintf(file, "Messages %s: %" PRIu64 "\n", message_names[i], stats.messages[i]);
+    }
+  }
+  fprintf(file, "Peak voices: %" PRIu64 "\n", stats.peak_voices);
+  fprintf(file, "Dropped notes: %" PRIu64 "\n", stats.voice_allocation_failures);
+  fprintf(file, "Voice blocks: %" PRIu64 "\n", stats.voice_blocks);
+  fprintf(file, "Idle blocks: %" PRIu64 "\n", stats.idle_blocks);
+#ifdef RBN_ATTACK_CACHE
+  if(stats.attack_hits + stats.attack_misses > 0) {
+    const double hit_rate = (double)stats.attack_hits / (double)(stats.attack_hits + stats.attack_misses);
+    fprintf(file, "Attack cache hits: %" PRIu64 " (%.1f%%)\n", stats.attack_hits, hit_rate * 100.0);
+  }
+#endif
+
+  // Blocks have to be rendered faster than they are played
+  const uint64_t deadline = ((uint64_t)RBN_BLOCK_SAMPLES * 1000000000) / inst->config.sample_rate;
+  fprintf(file, "Block time us (deadline %.1f, max %.1f):\n", (double)deadline / 1000.0, (double)stats.max_block_time / 1000.0);
+  for(uintptr_t i = 0; i < RBN_STATS_HISTOGRAM_BUCKETS; i++) {
+    if(stats.block_time_histogram[i] > 0) {
+      fprintf(file, "  %10.1f+ %" PRIu64 "\n", (double)((uint64_t)1 << i) / 1000.0, stats.block_time_histogram[i]);
+    }
+  }
+#else
+  (void)file;
+  (void)inst;
+#endif
+}
@@ -147,7 +147,7 @@ int rbncli_edit_prg(int argc, char** argv) {
   back_state[rces_op_env_point] = rces_op_env;
 
   ma_device device;
-  if(rbncli_init_ma_device(&device) != MA_SUCCESS) {
+  if(rbncli_init_ma_device(&device, NULL, NULL) != MA_SUCCESS) {
     return -1;
   }
 
@@ -0,0 +1,249 @@
+#include "rbncli.h"
+
+#include <string.h>
+
+typedef struct rbncli_track {
+  const uint8_t* cur;
+  const uint8_t* end;
+  uint64_t tick;
+  uint8_t running_status;
+} rbncli_track;
+
+struct rbncli_midi {
+  const uint8_t* data;
+  size_t size;
+  int mapped;
+
+  uint32_t sample_rate;
+  uint32_t division;
+
+  // Tempo map state, the anchor is kept unrounded so that positions never drift
+  double samples_per_tick;
+  double tempo_sample;
+  uint64_t tempo_tick;
+
+  // Min-heap of unfinished track indices ordered by next tick then track index
+  uint32_t* heap;
+  uint32_t heap_size;
+  uint32_t track_count;
+  uint64_t consumed_size;
+  uint64_t track_size;
+  rbncli_track tracks[];
+};
+
+static uint32_t read_be(const uint8_t* bytes, size_t size) {
+  uint32_t value = 0;
+  while(size-- > 0) {
+    value = (value << 8) | *bytes++;
+  }
+  return value;
+}
+
+static int read_variable_length(rbncli_track* track, uint32_t* value) {
+  *value = 0;
+  for(uintptr_t i = 0; i < 4 && track->cur < track->end; i++) {
+    const uint8_t byte = *track->cur++;
+    *value = (*value << 7) | (byte & 0x7f);
+    if(!(byte & 0x80)) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Reads the delta time preceding the next event, marking the track as done at its end
+static void read_delta_time(rbncli_track* track) {
+  uint32_t delta;
+  if(track->cur < track->end && read_variable_length(track, &delta) == 0) {
+    track->tick += delta;
+  } else {
+    track->cur = track->end;
+  }
+}
+
+static int heap_less(const rbncli_midi* midi, uint32_t a, uint32_t b) {
+  const uint64_t a_tick = midi->tracks[a].tick;
+  const uint64_t b_tick = midi->tracks[b].tick;
+  return a_tick < b_tick || (a_tick == b_tick && a < b);
+}
+
+static void heap_sift_down(rbncli_midi* midi, uint32_t index) {
+  uint32_t* heap = midi->heap;
+  while(1) {
+    uint32_t smallest = index;
+    const uint32_t left = index * 2 + 1;
+    const uint32_t right = left + 1;
+    if(left < midi->heap_size && heap_less(midi, heap[left], heap[smallest])) {
+      smallest = left;
+    }
+    if(right < midi->heap_size && heap_less(midi, heap[right], heap[smallest])) {
+      smallest = right;
+    }
+    if(smallest == index) {
+      return;
+    }
+    const uint32_t swap = heap[index];
+    heap[index] = heap[smallest];
+    heap[smallest] = swap;
+    index = smallest;
+  }
+}
+
+rbncli_midi* rbncli_midi_open_memory(const uint8_t* data, size_t size, uint32_t sample_rate) {
+  if(size < 14 || memcmp(data, "MThd", 4) || read_be(data + 4, 4) < 6) {
+    fprintf(stderr, "Doesn't look like a MIDI file: invalid MThd header\n");
+    return NULL;
+  }
+
+  const uint32_t track_count = read_be(data + 10, 2);
+  const uint32_t division = read_be(data + 12, 2);
+  if(division == 0) {
+    fprintf(stderr, "Doesn't look like a MIDI file: invalid division value\n");
+    return NULL;
+  }
+
+  rbncli_midi* midi = calloc(1, sizeof(rbncli_midi) + track_count * sizeof(rbncli_track));
+  midi->data = data;
+  midi->size = size;
+  midi->sample_rate = sample_rate;
+  midi->division = division;
+  midi->heap = malloc((track_count ? track_count : 1) * sizeof(uint32_t));
+
+  if(division & 0x8000) { // SMPTE frames, tempo changes have no effect
+    const int32_t fps = -(int8_t)(division >> 8);
+    midi->samples_per_tick = (double)sample_rate / ((fps == 29 ? 29.97 : fps) * (division & 0xff));
+  } else {
+    midi->samples_per_tick = (500000.0 * sample_rate) / (1000000.0 * division);
+  }
+
+  const uint8_t* chunk = data + 8 + read_be(data + 4, 4);
+  const uint8_t* data_end = data + size;
+  while(midi->track_count < track_count && chunk + 8 <= data_end) {
+    const uint32_t chunk_size = read_be(chunk + 4, 4);
+    const uint8_t* chunk_end = chunk_size > (size_t)(data_end - chunk - 8) ? data_end : chunk + 8 + chunk_size;
+    if(!memcmp(chunk, "MTrk", 4)) { // Unknown chunks are skipped
+      rbncli_track* track = midi->tracks + midi->track_count;
+      track->cur = chunk + 8;
+      track->end = chunk_end;
+      midi->track_size += chunk_end - track->cur;
+      read_delta_time(track);
+      if(track->cur < track->end) {
+        midi->heap[midi->heap_size++] = midi->track_count;
+      }
+      midi->track_count++;
+    }
+    chunk = chunk_end;
+  }
+
+  // Indices were pushed in increasing order, only ticks can break the heap property
+  for(uint32_t i = midi->heap_size / 2; i-- > 0;) {
+    heap_sift_down(midi, i);
+  }
+
+  return midi;
+}
+
+rbncli_midi* rbncli_midi_open_file(const char* filename, uint32_t sample_rate) {
+  size_t size;
+  const uint8_t* data = rbncli_map_file(filename, &size);
+  if(!data) {
+    fprintf(stderr, "Couldn't open file '%s'\n", filename);
+    return NULL;
+  }
+
+  rbncli_midi* midi = rbncli_midi_open_memory(data, size, sample_rate);
+  if(!midi) {
+    rbncli_unmap_file(data, size);
+    return NULL;
+  }
+  midi->mapped = 1;
+  return midi;
+}
+
+int rbncli_midi_next(rbncli_midi* midi, rbn_event* event) {
+  while(midi->heap_size > 0) {
+    rbncli_track* track = midi->tracks + midi->heap[0];
+    const uint8_t* start = track->cur;
+
+    const uint32_t sample = (uint32_t)(midi->tempo_sample + (track->tick - midi->tempo_tick) * midi->samples_per_tick + 0.5);
+
+    uint8_t status = *track->cur;
+    if(status & 0x80) {
+      track->cur++;
+    } else {
+      status = track->running_status;
+    }
+
+    int has_event = 0;
+    rbn_msg msg = {0};
+    if(status == 0xff) { // Meta event
+      uint32_t length;
+      const uint8_t meta_type = track->cur < track->end ? *track->cur++ : 0;
+      if(read_variable_length(track, &length) != 0 || length > (size_t)(track->end - track->cur)) {
+        track->cur = track->end;
+      } else if(meta_type == rbn_end_of_track) {
+        msg.type = rbn_end_of_track;
+        has_event = 1;
+        track->cur = track->end;
+      } else {
+        if(meta_type == rbn_set_tempo && length == 3 && !(midi->division & 0x8000)) {
+          midi->tempo_sample += (track->tick - midi->tempo_tick) * midi->samples_per_tick;
+          midi->tempo_tick = track->tick;
+          midi->samples_per_tick = (read_be(track->cur, 3) * (double)midi->sample_rate) / (1000000.0 * midi->division);
+        }
+        track->cur += length;
+      }
+    } else if(status == 0xf0 || status == 0xf7) { // SysEx
+      uint32_t length;
+      if(read_variable_length(track, &length) != 0 || length > (size_t)(track->end - track->cur)) {
+        track->cur = track->end;
+      } else {
+        track->cur += length;
+      }
+    } else if(status & 0x80) { // Channel message
+      const uint8_t data_size = (status & 0xf0) == rbn_program_change || (status & 0xf0) == rbn_channel_pressure ? 1 : 2;
+      if(data_size > track->end - track->cur) {
+        track->cur = track->end;
+      } else {
+        track->running_status = status;
+        msg.channel = status & 0x0f;
+        msg.type = status & 0xf0;
+        msg.u8[2] = track->cur[0];
+        msg.u8[3] = data_size > 1 ? track->cur[1] : 0;
+        track->cur += data_size;
+        has_event = 1;
+      }
+    } else {
+      fprintf(stderr, "Undefined status and invalid running status\n");
+      track->cur = track->end;
+    }
+
+    read_delta_time(track);
+    midi->consumed_size += track->cur - start;
+
+    // Either drop the finished track or move it to its next tick
+    if(track->cur >= track->end) {
+      midi->heap[0] = midi->heap[--midi->heap_size];
+    }
+    heap_sift_down(midi, 0);
+
+    if(has_event) {
+      event->sample = sample;
+      event->msg = msg;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+uint32_t rbncli_midi_get_progress(const rbncli_midi* midi) {
+  return midi->track_size > 0 ? (uint32_t)((midi->consumed_size * 100) / midi->track_size) : 100;
+}
+
+void rbncli_midi_close(rbncli_midi* midi) {
+  if(midi->mapped) {
+    rbncli_unmap_file(midi->data, midi->size);
+  }
+  free(midi->heap);
+  free(midi);
+}
@@ -6,6 +6,203 @@ HMIDIIN hmi = NULL;
 static void CALLBACK event_callback(HMIDIIN hMidiIn, UINT wMsg, DWORD_PTR dwInstance, DWORD_PTR dwParam1, DWORD_PTR dwParam2) {
   printf("%d\n", wMsg);
 }
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#define QUEUE_SIZE 1024 // Power of two
+#define LATENCY_BUCKETS 1000 // 100 us each, the last one counts everything above
+#define POLL_INTERVAL 100 // In milliseconds
+
+typedef struct input_msg {
+  uint64_t time; // When it was read, in nanoseconds
+  rbn_msg msg;
+} input_msg;
+
+typedef struct midi_input {
+  int fd;
+  uint64_t stop;
+  uint64_t eof;
+
+  rbn_parser parser; // Only used by the input thread
+
+  // Single producer single consumer ring, positions only ever increase
+  input_msg queue[QUEUE_SIZE];
+  uint64_t write_pos;
+  uint64_t read_pos;
+  uint64_t dropped;
+
+  // Time from reading the bytes to handing the audio containing them to the device
+  uint64_t latency_histogram[LATENCY_BUCKETS];
+  uint64_t max_latency;
+} midi_input;
+
+static void push_msg(midi_input* input, rbn_msg msg, uint64_t time) {
+  const uint64_t write_pos = input->write_pos;
+  if(write_pos - RBNCLI_LOAD_ACQUIRE(input->read_pos) == QUEUE_SIZE) {
+    RBNCLI_ADD(input->dropped, 1);
+    return;
+  }
+  input_msg* item = input->queue + (write_pos & (QUEUE_SIZE - 1));
+  item->time = time;
+  item->msg = msg;
+  RBNCLI_STORE_RELEASE(input->write_pos, write_pos + 1);
+}
+
+static void input_thread(void* data) {
+  midi_input* input = data;
+  struct pollfd pfd = {.fd = input->fd, .events = POLLIN};
+  uint8_t bytes[256];
+  while(!RBNCLI_LOAD(input->stop)) {
+    if(poll(&pfd, 1, POLL_INTERVAL) <= 0) {
+      continue;
+    }
+    const ssize_t count = read(input->fd, bytes, sizeof(bytes));
+    if(count <= 0) {
+      break;
+    }
+    const uint64_t time = rbncli_get_time_ns();
+    rbn_msg msg;
+    for(ssize_t i = 0; i < count; i++) {
+      if(rbn_parse_byte(&input->parser, bytes[i], &msg)) {
+        push_msg(input, msg, time);
+      }
+    }
+  }
+  RBNCLI_STORE(input->eof, 1);
+}
+
+static void render_input(int16_t* output, uint32_t frame_count, void* data) {
+  midi_input* input = data;
+  const uint64_t read_pos = input->read_pos;
+  const uint64_t write_pos = RBNCLI_LOAD_ACQUIRE(input->write_pos);
+  for(uint64_t pos = read_pos; pos < write_pos; pos++) {
+    rbn_send_msg(&inst, input->queue[pos & (QUEUE_SIZE - 1)].msg);
+  }
+
+  rbn_output_config output_config = {
+    .left_buffer = output,
+    .right_buffer = output + 1,
+    .stride = 2,
+    .sample_count = frame_count,
+    .sample_format = rbn_s16,
+  };
+  rbn_render(&inst, &output_config);
+
+  // Slots cannot be overwritten before the read position moves past them
+  const uint64_t time = rbncli_get_time_ns();
+  for(uint64_t pos = read_pos; pos < write_pos; pos++) {
+    const uint64_t latency = time - input->queue[pos & (QUEUE_SIZE - 1)].time;
+    uint64_t bucket = latency / 100000;
+    if(bucket >= LATENCY_BUCKETS) {
+      bucket = LATENCY_BUCKETS - 1;
+    }
+    RBNCLI_ADD(input->latency_histogram[bucket], 1);
+    if(latency > input->max_latency) {
+      RBNCLI_STORE(input->max_latency, latency);
+    }
+  }
+  RBNCLI_STORE_RELEASE(input->read_pos, write_pos);
+}
+
+static double get_latency_percentile(const midi_input* input, uint32_t percentile) {
+  const uint64_t target = (input->read_pos * percentile + 99) / 100;
+  uint64_t count = 0;
+  for(uint32_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    count += input->latency_histogram[bucket];
+    if(count >= target && count > 0) {
+      const double max_latency = (double)input->max_latency / 1000000.0;
+      const double latency = (double)(bucket + 1) / 10.0;
+      return latency < max_latency ? latency : max_latency;
+    }
+  }
+  return 0.0;
+}
+
+static int list_devices() {
+  DIR* dir = opendir("/dev/snd");
+  int found = 0;
+  if(dir) {
+    struct dirent* entry;
+    while((entry = readdir(dir))) {
+      if(!strncmp(entry->d_name, "midiC", 5)) {
+        if(!found) {
+          printf("Devices:\n");
+        }
+        printf("- /dev/snd/%s\n", entry->d_name);
+        found = 1;
+      }
+    }
+    closedir(dir);
+  }
+  if(!found) {
+    printf("No MIDI device detected\n");
+    return -1;
+  }
+  return 0;
+}
+
+// Plays a raw MIDI byte stream (device node, FIFO or stdin) until it ends or enter is pressed
+static int open_stream(const char* path) {
+  const int from_stdin = !strcmp(path, "-");
+  midi_input* input = calloc(1, sizeof(midi_input));
+  input->fd = from_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+  if(input->fd < 0) {
+    fprintf(stderr, "Couldn't open '%s'\n", path);
+    free(input);
+    return -1;
+  }
+
+  rbn_reset(&inst);
+
+  ma_device device;
+  if(rbncli_init_ma_device(&device, render_input, input) != MA_SUCCESS) {
+    if(!from_stdin) {
+      close(input->fd);
+    }
+    free(input);
+    return -1;
+  }
+
+  void* thread = rbncli_create_thread(input_thread, input);
+  printf(from_stdin ? "Playing until the end of the input\n" : "Playing, press enter to stop\n");
+  struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+  int watch_stdin = !from_stdin;
+  while(!RBNCLI_LOAD(input->eof)) {
+    if(watch_stdin && poll(&pfd, 1, POLL_INTERVAL) > 0) {
+      char c;
+      if(read(STDIN_FILENO, &c, 1) > 0) {
+        break;
+      }
+      watch_stdin = 0; // Closed, so only the end of the input stops playback
+    } else if(!watch_stdin) {
+      rbncli_sleep(POLL_INTERVAL);
+    }
+  }
+  RBNCLI_STORE(input->stop, 1);
+  rbncli_join_thread(thread);
+
+  // Give the audio thread time to play what is still queued
+  rbncli_sleep(POLL_INTERVAL);
+  ma_device_uninit(&device);
+  if(!from_stdin) {
+    close(input->fd);
+  }
+
+  printf("Messages: %" PRIu64 "\n", input->read_pos);
+  printf("Dropped messages: %" PRIu64 "\n", input->dropped);
+  printf("Input to output latency ms (p50, p99, max): %.1f, %.1f, %.1f\n", get_latency_percentile(input, 50), get_latency_percentile(input, 99), (double)input->max_latency / 1000000.0);
+  rbncli_deadline_stats deadline_stats;
+  rbncli_get_deadline_stats(&deadline_stats);
+  rbncli_print_deadline_stats(stdout, &deadline_stats);
+  rbncli_print_stats(stdout, &inst);
+
+  free(input);
+  return 0;
+}
 #endif
 
 int rbncli_open_device(int argc, char** argv) {
@@ -24,6 +221,8 @@ int rbncli_open_device(int argc, char** argv) {
       midiInGetDevCaps(i, &caps, sizeof(MIDIINCAPS));
       printf("- %d: name = %s\n", i, caps.szPname);
     }
+#else
+    return list_devices();
 #endif
   } else {
 #ifdef _WIN32
@@ -34,7 +233,8 @@ int rbncli_open_device(int argc, char** argv) {
       return -1;
     }
     midiInStart(hmi);
-
+#else
+    return open_stream(argv[0]);
 #endif
   }
   return 0;
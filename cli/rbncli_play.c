@@ -1,51 +1,277 @@
 #include "rbncli.h"
 
+#include <string.h>
+
+#define POLL_INTERVAL 100 // In milliseconds
+#define AHEAD_CHUNK RBN_BLOCK_SAMPLES // Frames rendered by the worker each time it holds the lock
+#define AHEAD_MIN_FRAMES 2048
+
+// Events are dispatched by the renderer itself, at the exact sample they are due, so the instance
+// is only ever touched by one thread at a time: the audio thread, or the render-ahead worker
+typedef struct sequencer {
+  const rbn_event* events;
+  uint64_t event_count;
+  uint32_t channel_mask;
+
+  // Read by the main thread to follow playback
+  uint64_t event_index;
+  uint64_t sample_index;
+} sequencer;
+
+static void render_sequence(int16_t* output, uint32_t frame_count, void* data) {
+  sequencer* seq = data;
+  uint64_t event_index = seq->event_index;
+  uint64_t sample_index = seq->sample_index;
+  while(frame_count > 0) {
+    for(; event_index < seq->event_count && seq->events[event_index].sample <= sample_index; event_index++) {
+      const rbn_event* event = seq->events + event_index;
+      if((1 << event->msg.channel) & seq->channel_mask) {
+        rbn_send_msg(&inst, event->msg);
+      }
+    }
+
+    uint32_t render_count = frame_count;
+    if(event_index < seq->event_count && seq->events[event_index].sample - sample_index < render_count) {
+      render_count = (uint32_t)(seq->events[event_index].sample - sample_index);
+    }
+
+    rbn_output_config output_config = {
+      .left_buffer = output,
+      .right_buffer = output + 1,
+      .stride = 2,
+      .sample_count = render_count,
+      .sample_format = rbn_s16,
+    };
+    rbn_render(&inst, &output_config);
+
+    output += render_count * 2;
+    frame_count -= render_count;
+    sample_index += render_count;
+  }
+  RBNCLI_STORE(seq->event_index, event_index);
+  RBNCLI_STORE(seq->sample_index, sample_index);
+}
+
+// A worker renders the sequence ahead into a single producer single consumer ring, and the audio
+// callback only copies from it. Whoever holds the lock renders, so when the ring runs dry the callback
+// can take over for the frames it is missing without racing the worker. The worker only holds the lock
+// for one block at a time and leaves it to the callback when asked, so the callback's wait is short
+typedef struct render_ahead {
+  sequencer* seq;
+  int16_t* frames; // Interleaved stereo
+  uint64_t capacity; // In frames, power of two
+  uint64_t write_pos; // Positions only ever increase
+  uint64_t read_pos;
+  long rendering;
+  uint64_t wanted; // Set by the callback while it waits for the lock
+  uint64_t stop;
+  void* thread;
+
+  uint64_t fallback_frames; // Rendered by the callback itself
+  uint64_t dropped_frames; // Silence, the worker didn't let go of the lock in time
+} render_ahead;
+
+static void render_ahead_thread(void* data) {
+  render_ahead* ahead = data;
+  while(!RBNCLI_LOAD(ahead->stop)) {
+    if(RBNCLI_LOAD(ahead->wanted) || !RBNCLI_TRY_LOCK(ahead->rendering)) {
+      rbncli_sleep(1); // The callback only holds it for one of its periods
+      continue;
+    }
+    const uint64_t write_pos = ahead->write_pos;
+    if(ahead->capacity - (write_pos - RBNCLI_LOAD_ACQUIRE(ahead->read_pos)) < AHEAD_CHUNK) {
+      RBNCLI_UNLOCK(ahead->rendering);
+      rbncli_sleep(1);
+      continue;
+    }
+
+    const uint64_t offset = write_pos & (ahead->capacity - 1);
+    const uint32_t first_count = ahead->capacity - offset < AHEAD_CHUNK ? (uint32_t)(ahead->capacity - offset) : AHEAD_CHUNK;
+    render_sequence(ahead->frames + offset * 2, first_count, ahead->seq);
+    if(first_count < AHEAD_CHUNK) {
+      render_sequence(ahead->frames, AHEAD_CHUNK - first_count, ahead->seq);
+    }
+    RBNCLI_STORE_RELEASE(ahead->write_pos, write_pos + AHEAD_CHUNK);
+    RBNCLI_UNLOCK(ahead->rendering);
+  }
+}
+
+static uint32_t copy_ahead(render_ahead* ahead, uint64_t* read_pos, int16_t* output, uint32_t frame_count) {
+  const uint64_t available = RBNCLI_LOAD_ACQUIRE(ahead->write_pos) - *read_pos;
+  const uint32_t count = available < frame_count ? (uint32_t)available : frame_count;
+  for(uint32_t i = 0; i < count; i++) {
+    const int16_t* frame = ahead->frames + ((*read_pos + i) & (ahead->capacity - 1)) * 2;
+    output[i * 2 + 0] = frame[0];
+    output[i * 2 + 1] = frame[1];
+  }
+  *read_pos += count;
+  return count;
+}
+
+static void play_ahead(int16_t* output, uint32_t frame_count, void* data) {
+  render_ahead* ahead = data;
+  uint64_t read_pos = ahead->read_pos;
+  uint32_t done = copy_ahead(ahead, &read_pos, output, frame_count);
+  if(done < frame_count) {
+    // Waits for the worker to finish its block, for up to half of the callback's period
+    const uint64_t deadline = rbncli_get_time_ns() + (uint64_t)frame_count * 500000000 / sample_rate;
+    RBNCLI_STORE(ahead->wanted, 1);
+    int locked;
+    while(!(locked = RBNCLI_TRY_LOCK(ahead->rendering)) && rbncli_get_time_ns() < deadline) {
+    }
+    RBNCLI_STORE(ahead->wanted, 0);
+    if(locked) {
+      // The worker may have filled the ring before letting go of the lock, what is left of it stays
+      // for the next callback
+      done += copy_ahead(ahead, &read_pos, output + done * 2, frame_count - done);
+      if(done < frame_count) {
+        render_sequence(output + done * 2, frame_count - done, ahead->seq);
+        RBNCLI_ADD(ahead->fallback_frames, frame_count - done);
+        read_pos += frame_count - done;
+        RBNCLI_STORE_RELEASE(ahead->write_pos, read_pos);
+      }
+      RBNCLI_STORE_RELEASE(ahead->read_pos, read_pos);
+      RBNCLI_UNLOCK(ahead->rendering);
+      return;
+    }
+    memset(output + done * 2, 0, (frame_count - done) * sizeof(int16_t) * 2);
+    RBNCLI_ADD(ahead->dropped_frames, frame_count - done);
+  }
+  RBNCLI_STORE_RELEASE(ahead->read_pos, read_pos);
+}
+
+static void print_monitor(uint32_t progress) {
+  rbncli_deadline_stats stats;
+  rbncli_get_deadline_stats(&stats);
+  printf("\r%02u%%\tload p50 %3u%%  p99 %3u%%  max %3u%%  overruns %" PRIu64 "   ", progress,
+    rbncli_get_load_percentile(&stats, 50), rbncli_get_load_percentile(&stats, 99), rbncli_get_load_percentile(&stats, 100), stats.overruns);
+  fflush(stdout);
+}
+
 int rbncli_play_mid(int argc, char** argv) {
-  const char* filename = argv[0];
-  const uint32_t channel_mask = argc > 1 ? (1 << atoi(argv[1])) : ~0;
+  const char* filename = NULL;
+  const char* trace_filename = NULL;
+  uint32_t channel_mask = ~0;
+  uint32_t ahead_ms = 0;
+  int monitor = 0;
+  for(int i = 0; i < argc; i++) {
+    if(!strcmp(argv[i], "-trace") && i + 1 < argc) {
+      trace_filename = argv[++i];
+    } else if(!strcmp(argv[i], "-ahead") && i + 1 < argc) {
+      ahead_ms = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-monitor")) {
+      monitor = 1;
+    } else if(!filename) {
+      filename = argv[i];
+    } else {
+      channel_mask = 1 << atoi(argv[i]);
+    }
+  }
 
-  tml_message* mid_seq = tml_load_filename(filename);
-  if(!mid_seq) {
+  if(!filename) {
+    rbncli_print_help(0, NULL);
     return -1;
   }
 
-  unsigned int total_time;
-  tml_get_info(mid_seq, NULL, NULL, NULL, NULL, &total_time);
+  rbncli_timeline timeline;
+  if(rbncli_timeline_load_file(&timeline, filename, sample_rate) != 0) {
+    return -1;
+  }
 
-  ma_device device;
-  if(rbncli_init_ma_device(&device) != MA_SUCCESS) {
-    tml_free(mid_seq);
+  if(trace_filename && rbncli_trace_begin(trace_filename) != 0) {
+    rbncli_timeline_free(&timeline);
     return -1;
   }
 
+  rbn_reset(&inst);
+
+  sequencer seq = {
+    .events = timeline.events,
+    .event_count = timeline.event_count,
+    .channel_mask = channel_mask,
+  };
+
   uint32_t progress = 0;
   rbncli_progress_bar(progress, NULL);
 
-  rbn_reset(&inst);
-
-  tml_message* current_msg = mid_seq;
-  uint64_t current_time = 0;
-  while(current_msg) {
-    rbncli_progress_bar((uint32_t)((current_time * 100) / total_time), &progress);
+  render_ahead ahead = {.seq = &seq, .capacity = AHEAD_MIN_FRAMES};
+  if(ahead_ms > 0) {
+    while(ahead.capacity < (uint64_t)ahead_ms * sample_rate / 1000) {
+      ahead.capacity *= 2;
+    }
+    ahead.frames = malloc(ahead.capacity * sizeof(int16_t) * 2);
+    ahead.thread = ahead.frames ? rbncli_create_thread(render_ahead_thread, &ahead) : NULL;
+    if(!ahead.thread) {
+      fprintf(stderr, "Couldn't start rendering ahead\n");
+      free(ahead.frames);
+      if(trace_filename) {
+        rbncli_trace_end();
+      }
+      rbncli_timeline_free(&timeline);
+      return -1;
+    }
+    // Playback starts with a full ring
+    while(RBNCLI_LOAD_ACQUIRE(ahead.write_pos) + AHEAD_CHUNK <= ahead.capacity) {
+      rbncli_sleep(1);
+    }
+  }
 
-    int64_t time_to_wait = current_msg->time - current_time;
-    if(time_to_wait > 0) {
-      const uint64_t previous_time_us = rbncli_get_time();
-      rbncli_sleep((uint32_t)time_to_wait);
-      const uint64_t elapsed_time_us = rbncli_get_time() - previous_time_us;
-      current_time += elapsed_time_us / 1000;
+  ma_device device;
+  if(rbncli_init_ma_device(&device, ahead_ms > 0 ? play_ahead : render_sequence, ahead_ms > 0 ? (void*)&ahead : (void*)&seq) != MA_SUCCESS) {
+    if(ahead.thread) {
+      RBNCLI_STORE(ahead.stop, 1);
+      rbncli_join_thread(ahead.thread);
+      free(ahead.frames);
+    }
+    if(trace_filename) {
+      rbncli_trace_end();
     }
+    rbncli_timeline_free(&timeline);
+    return -1;
+  }
 
-    if((1 << current_msg->channel) & channel_mask) {
-      rbncli_send_tml_msg(&inst, current_msg);
+  // Rendering runs ahead of what is heard, so the end is reached when the ring is played back
+  while(ahead_ms > 0 ? RBNCLI_LOAD_ACQUIRE(ahead.read_pos) < timeline.sample_count : RBNCLI_LOAD(seq.event_index) < seq.event_count) {
+    rbncli_sleep(POLL_INTERVAL);
+
+    const uint64_t sample_index = ahead_ms > 0 ? RBNCLI_LOAD_ACQUIRE(ahead.read_pos) : RBNCLI_LOAD(seq.sample_index);
+    const uint32_t current = timeline.sample_count > 0 && sample_index < timeline.sample_count ? (uint32_t)((sample_index * 100) / timeline.sample_count) : 99;
+    if(monitor) {
+      print_monitor(current);
+    } else {
+      rbncli_progress_bar(current, &progress);
     }
-    current_msg = current_msg->next;
   }
 
+  ma_device_uninit(&device);
+  if(ahead.thread) {
+    RBNCLI_STORE(ahead.stop, 1);
+    rbncli_join_thread(ahead.thread);
+    free(ahead.frames);
+  }
+
+  if(monitor) {
+    printf("\n");
+  }
   rbncli_progress_bar(100, &progress);
 
-  tml_free(mid_seq);
-  ma_device_uninit(&device);
+  rbncli_timeline_free(&timeline);
+
+  rbncli_deadline_stats deadline_stats;
+  rbncli_get_deadline_stats(&deadline_stats);
+  rbncli_print_deadline_stats(stdout, &deadline_stats);
+  if(ahead_ms > 0) {
+    printf("Render-ahead ms: %u\n", (uint32_t)(ahead.capacity * 1000 / sample_rate));
+    printf("Frames rendered by the callback: %" PRIu64 "\n", ahead.fallback_frames);
+    printf("Frames dropped: %" PRIu64 "\n", ahead.dropped_frames);
+  }
+
+  // The device is stopped so the trace can be written without racing the audio thread
+  if(trace_filename && rbncli_trace_end() != 0) {
+    fprintf(stderr, "Couldn't write to file '%s'\n", trace_filename);
+  }
+
+  rbncli_print_stats(stdout, &inst);
 
   return 0;
 }
@@ -1,175 +1,586 @@
 #include "rbncli.h"
 
+#include <math.h>
 #include <string.h>
 
-static void fputui(unsigned int value, size_t size, FILE* stream) {
-  while(size > 0) {
-    fputc(value & 0xff, stream);
-    size -= 1;
-    value >>= 8;
-  }
-}
-
-static tml_message* demo_sequence() {
-  static tml_message* seq = NULL;
-  if(!seq) {
-    seq = calloc(1, 128 * (6 * 2 + 1) * sizeof(tml_message));
-
-    unsigned int time = 0;
-    tml_message* cur = seq;
-    const char chord[3] = {0, 4, 7};
-    for(uintptr_t i = 0; i < 128; i++) {
-      cur->time = time;
-      cur->type = TML_PROGRAM_CHANGE;
-      cur->program = (char)i;
+#include "../util/rbnutil_workload.h"
+
+static void demo_sequence(rbncli_timeline* timeline) {
+  timeline->events = calloc(128 * (3 * 2 + 1) + 47 * 3, sizeof(rbn_event));
+  timeline->event_count = 0;
+
+  uint32_t time = 0; // In milliseconds
+  rbn_event* cur = timeline->events;
+  const uint8_t chord[3] = {0, 4, 7};
+  for(uintptr_t i = 0; i < 128; i++) {
+    cur->sample = (uint32_t)((uint64_t)time * sample_rate / 1000);
+    cur->msg.type = rbn_program_change;
+    cur->msg.instrument = (uint8_t)i;
+    cur++;
+    for(uintptr_t j = 0; j < 3; j++) {
+      uint8_t key = 60 + chord[j];
+      cur->sample = (uint32_t)((uint64_t)time * sample_rate / 1000);
+      cur->msg.type = rbn_note_on;
+      cur->msg.key = key;
+      cur->msg.velocity = 127;
       cur++;
-      for(uintptr_t j = 0; j < 3; j++) {
-        char key = 60 + chord[j];
-        cur->time = time;
-        cur->type = TML_NOTE_ON;
-        cur->key = key;
-        cur->velocity = 127;
-        cur++;
-
-        time += 256;
-        cur->time = time;
-        cur->type = TML_NOTE_OFF;
-        cur->key = key;
-        cur++;
-      }
+
       time += 256;
+      cur->sample = (uint32_t)((uint64_t)time * sample_rate / 1000);
+      cur->msg.type = rbn_note_off;
+      cur->msg.key = key;
+      cur++;
     }
+    time += 256;
+  }
 
-    for(uintptr_t i = 35; i < 82; i++) {
-      for(uintptr_t j = 0; j < 3; j++) {
-        cur->time = time;
-        cur->type = TML_NOTE_ON;
-        cur->channel = 9;
-        cur->key = (char)i;
-        cur->velocity = 127;
-        cur++;
+  for(uintptr_t i = 35; i < 82; i++) {
+    for(uintptr_t j = 0; j < 3; j++) {
+      cur->sample = (uint32_t)((uint64_t)time * sample_rate / 1000);
+      cur->msg.type = rbn_note_on;
+      cur->msg.channel = 9;
+      cur->msg.key = (uint8_t)i;
+      cur->msg.velocity = 127;
+      cur++;
 
-        time += 256;
-      }
       time += 256;
     }
+    time += 256;
+  }
+
+  timeline->event_count = (uint32_t)(cur - timeline->events);
+  timeline->sample_count = cur[-1].sample;
+}
+
+static int stress_sequence(rbncli_timeline* timeline, const rbnutil_workload* workload) {
+  timeline->event_count = rbnutil_workload_generate(workload, &inst, NULL, 0);
+  timeline->events = calloc(timeline->event_count, sizeof(rbn_event));
+  if(!timeline->events) {
+    fprintf(stderr, "Couldn't allocate %u events for the stress workload\n", timeline->event_count);
+    timeline->event_count = 0;
+    return -1;
+  }
+  rbnutil_workload_generate(workload, &inst, timeline->events, timeline->event_count);
+  timeline->sample_count = (uint32_t)((uint64_t)workload->duration_ms * sample_rate / 1000);
+  return 0;
+}
+
+// Files are parsed lazily while rendering, unless a cached timeline exists
+typedef struct render_source {
+  const void* file_data;
+  size_t file_size;
+  rbncli_midi* midi;
+  rbncli_cache cache;
+  rbncli_timeline timeline;
+  uint32_t index;
+} render_source;
+
+static int open_source(render_source* source, const char* filename, const rbnutil_workload* workload, int use_cache) {
+  memset(source, 0, sizeof(*source));
+  if(!strcmp(filename, "demo")) {
+    demo_sequence(&source->timeline);
+    return 0;
+  }
+  if(!strcmp(filename, "stress")) {
+    return stress_sequence(&source->timeline, workload);
+  }
+
+  source->file_data = rbncli_map_file(filename, &source->file_size);
+  if(!source->file_data) {
+    fprintf(stderr, "Couldn't open file '%s'\n", filename);
+    return -1;
+  }
+
+  if(use_cache && rbncli_cache_lookup(&source->cache, &source->timeline, source->file_data, source->file_size, sample_rate) == 0) {
+    return 0;
+  }
 
-    for(tml_message* msg = seq; msg < cur - 1; msg++) {
-      msg->next = msg + 1;
+  source->midi = rbncli_midi_open_memory(source->file_data, source->file_size, sample_rate);
+  if(!source->midi) {
+    rbncli_unmap_file(source->file_data, source->file_size);
+    return -1;
+  }
+  if(use_cache) {
+    rbncli_cache_begin(&source->cache);
+  }
+  return 0;
+}
+
+static int next_event(render_source* source, rbn_event* event) {
+  if(source->midi) {
+    if(rbncli_midi_next(source->midi, event) != 0) {
+      rbncli_cache_end(&source->cache);
+      return -1;
     }
+    rbncli_cache_add(&source->cache, event);
+    return 0;
+  } else if(source->index < source->timeline.event_count) {
+    *event = source->timeline.events[source->index++];
+    return 0;
   }
-  return seq;
+  return -1;
 }
 
-int rbncli_render_mid(int argc, char** argv) {
-  const char* filename = argv[0];
-  const uint32_t channel_mask = argc > 1 ? (1 << atoi(argv[1])) : ~0;
+static uint32_t get_progress(const render_source* source) {
+  if(source->midi) {
+    return rbncli_midi_get_progress(source->midi);
+  }
+  return (uint32_t)(((uint64_t)source->index * 100) / source->timeline.event_count);
+}
 
-  tml_message* mid_seq = NULL;
-  if(!strcmp(filename, "demo")) {
-    mid_seq = demo_sequence();
+static void close_source(render_source* source) {
+  if(source->midi) {
+    rbncli_cache_cancel(&source->cache); // Only does something if parsing was interrupted
+    rbncli_midi_close(source->midi);
   } else {
-    mid_seq = tml_load_filename(filename);
+    rbncli_timeline_free(&source->timeline);
+  }
+  if(source->file_data) {
+    rbncli_unmap_file(source->file_data, source->file_size);
   }
+}
 
-  if(!mid_seq) {
-    return -1;
+#define RENDER_BATCH_EVENTS 4096
+#define RENDER_ATTACK_TIME 0.25f // Seconds of attack recorded per note
+#define RENDER_SPOOL_FRAMES 4096
+
+static rbn_event batch[RENDER_BATCH_EVENTS];
+
+typedef struct render_output {
+  rbncli_wav* wav;
+  rbncli_wav* stem_wavs[RBN_CHAN_COUNT]; // Only opened with -stems
+  rbn_output_config stems[RBN_CHAN_COUNT];
+} render_output;
+
+static void point_to_wav(rbncli_wav* wav, rbn_output_config* buffer, uint64_t sample_count) {
+  rbncli_wav_commit(wav, (uint32_t)sample_count);
+  uint32_t frame_count;
+  int16_t* samples = rbncli_wav_get_buffer(wav, &frame_count);
+  buffer->left_buffer = samples;
+  buffer->right_buffer = samples + 1;
+  buffer->sample_count = frame_count;
+}
+
+// Hands full buffers to the writer threads and renders straight into the next ones
+// Stem writers are filled in lockstep with the mix one, so their buffers always have the same room
+static void write_to_wav(void* data, rbn_output_config* buffer, uint64_t sample_count) {
+  render_output* output = data;
+  point_to_wav(output->wav, buffer, sample_count);
+  for(uintptr_t i = 0; i < RBN_CHAN_COUNT; i++) {
+    if(output->stem_wavs[i]) {
+      point_to_wav(output->stem_wavs[i], output->stems + i, sample_count);
+    }
   }
+}
 
-  unsigned int total_time;
-  tml_get_info(mid_seq, NULL, NULL, NULL, NULL, &total_time);
+static uint64_t get_stall_time(const render_output* output) {
+  uint64_t stall_time = rbncli_wav_get_stall_time(output->wav);
+  for(uintptr_t i = 0; i < RBN_CHAN_COUNT; i++) {
+    if(output->stem_wavs[i]) {
+      stall_time += rbncli_wav_get_stall_time(output->stem_wavs[i]);
+    }
+  }
+  return stall_time;
+}
 
-  char wavfilename[128] = "";
-  strcpy(wavfilename, filename);
-  strcpy(strrchr(wavfilename, '.'), ".wav");
+// Returns the number of files that could not be written
+static int close_output(render_output* output) {
+  int failures = rbncli_wav_close(output->wav) != 0;
+  for(uintptr_t i = 0; i < RBN_CHAN_COUNT; i++) {
+    if(output->stem_wavs[i]) {
+      failures += rbncli_wav_close(output->stem_wavs[i]) != 0;
+    }
+  }
+  return failures;
+}
 
-  const uint32_t channels = 2;
-  const uint32_t bytes_per_block = sizeof(int16_t) * channels;
-  const uint32_t bits_per_sample = sizeof(int16_t) * 8;
-  const uint32_t bytes_per_second = (sample_rate * bits_per_sample * channels) / 8;
+// With -normalize, unnormalized samples are spooled to a temporary file while their peak is found,
+// then converted in a second pass so the whole render gets a single gain
+typedef struct render_spool {
+  FILE* file;
+  float peak;
+  int error;
+  float samples[RENDER_SPOOL_FRAMES * 2];
+} render_spool;
+
+static void write_to_spool(void* data, rbn_output_config* buffer, uint64_t sample_count) {
+  render_spool* spool = data;
+  float peak = spool->peak;
+  for(uintptr_t i = 0; i < sample_count * 2; i++) {
+    peak = fmaxf(peak, fabsf(spool->samples[i]));
+  }
+  spool->peak = peak;
+  if(sample_count > 0 && !spool->error && fwrite(spool->samples, sizeof(float) * 2, sample_count, spool->file) != sample_count) {
+    spool->error = 1;
+  }
+  buffer->left_buffer = spool->samples;
+  buffer->right_buffer = spool->samples + 1;
+  buffer->sample_count = RENDER_SPOOL_FRAMES;
+}
 
-  FILE* wavfile = fopen(wavfilename, "wb");
-  fputs("RIFF----WAVEfmt ", wavfile);
-  fputui(16, 4, wavfile); // No extension data
-  fputui(1, 2, wavfile); // PCM
-  fputui(channels, 2, wavfile); // Channels
-  fputui(sample_rate, 4, wavfile); // Sample rate
-  fputui(bytes_per_second, 4, wavfile); // Byte rate
-  fputui(bytes_per_block, 2, wavfile); // Bytes per block
-  fputui(bits_per_sample, 2, wavfile); // Bits per sample
+// The gain is the one robin would have ended up with, applied from the start
+static int write_spool_to_wav(render_spool* spool, rbncli_wav* wav) {
+  const float range = fmaxf(spool->peak * 1.01f, 1.f);
+  const float gain = 0x8000 / range;
+  rewind(spool->file);
+  size_t frame_count;
+  while(!spool->error && (frame_count = fread(spool->samples, sizeof(float) * 2, RENDER_SPOOL_FRAMES, spool->file)) > 0) {
+    const float* samples = spool->samples;
+    while(frame_count > 0) {
+      uint32_t room;
+      int16_t* output = rbncli_wav_get_buffer(wav, &room);
+      if(room > frame_count) {
+        room = (uint32_t)frame_count;
+      }
+      for(uintptr_t i = 0; i < room * 2; i++) {
+        output[i] = (int16_t)(samples[i] * gain);
+      }
+      rbncli_wav_commit(wav, room);
+      samples += room * 2;
+      frame_count -= room;
+    }
+  }
+  return spool->error || ferror(spool->file) ? -1 : 0;
+}
 
-  const long data_chunk_pos = ftell(wavfile);
-  fputs("data----", wavfile);
+// Copies filename with its extension replaced, or as is when extension is null
+// Returns -1 if the path doesn't fit
+static int replace_extension(char* path, size_t size, const char* filename, const char* extension) {
+  const char* dot = extension ? strrchr(filename, '.') : NULL;
+  const int base_length = (int)(dot ? (size_t)(dot - filename) : strlen(filename));
+  const int length = snprintf(path, size, "%.*s%s", base_length, filename, extension ? extension : "");
+  if(length < 0 || (size_t)length >= size) {
+    fprintf(stderr, "Path too long: '%s'\n", filename);
+    return -1;
+  }
+  return 0;
+}
 
-  uint32_t progress = 0;
-  rbncli_progress_bar(progress, NULL);
+// Stems are named after the output file, or the input one when streaming, with the channel index
+static int open_stems(render_output* output, const char* base_filename, int raw) {
+  char stemfilename[RBNCLI_PATH_MAX];
+  for(uintptr_t i = 0; i < RBN_CHAN_COUNT; i++) {
+    char extension[32];
+    snprintf(extension, sizeof(extension), ".channel%u%s", (uint32_t)i, raw ? ".pcm" : ".wav");
+    if(replace_extension(stemfilename, sizeof(stemfilename), base_filename, extension) != 0) {
+      return -1;
+    }
+    output->stem_wavs[i] = rbncli_wav_open(stemfilename, raw);
+    if(!output->stem_wavs[i]) {
+      return -1;
+    }
+    output->stems[i].stride = 2;
+    output->stems[i].sample_format = rbn_s16;
+  }
+  return 0;
+}
 
-  rbn_reset(&inst);
+// Needs the whole sequence up front to know which channels changed since they were cached
+static int render_incremental(render_source* source, uint32_t channel_mask, rbncli_wav* wav, FILE* log) {
+  rbn_event* events = NULL;
+  uint32_t event_count = 0;
+  uint32_t capacity = 0;
+  uint32_t last_sample = 0;
+  rbn_event event;
+  while(next_event(source, &event) == 0) {
+    // Events that go back in time are sent right away
+    if(event.sample > last_sample) {
+      last_sample = event.sample;
+    }
+    if((1 << event.msg.channel) & channel_mask) {
+      if(event_count == capacity) {
+        capacity = capacity ? capacity * 2 : 1024;
+        events = realloc(events, capacity * sizeof(rbn_event));
+      }
+      events[event_count].sample = last_sample;
+      events[event_count].msg = event.msg;
+      event_count++;
+    }
+  }
 
-  tml_message* current_msg = mid_seq;
-  uint64_t current_sample = 0;
-  uint64_t total_rendering_time = 0;
-  while(current_msg) {
-    const uint64_t current_time = (current_sample * 1000) / sample_rate;
+  const int result = rbncli_render_incremental(events, event_count, last_sample, wav, log);
+  free(events);
+  return result;
+}
 
-    rbncli_progress_bar((uint32_t)((current_time * 100) / total_time), &progress);
+int rbncli_render_mid(int argc, char** argv) {
+  const char* filename = NULL;
+  const char* output_filename = NULL;
+  const char* trace_filename = NULL;
+  uint32_t channel_mask = ~0;
+  int raw = 0;
+  int stems = 0;
+  int incremental = 0;
+  int oneshot_variations = -1; // Percussion is synthesized when negative
+  int attack_cache_mib = 0;
+  int normalize = 0;
+  int use_cache = 1;
+  rbnutil_workload workload;
+  rbnutil_workload_defaults(&workload, rbnutil_workload_all, 1, sample_rate);
+  for(int i = 0; i < argc; i++) {
+    if(!strcmp(argv[i], "-o") && i + 1 < argc) {
+      output_filename = argv[++i];
+    } else if(!strcmp(argv[i], "-trace") && i + 1 < argc) {
+      trace_filename = argv[++i];
+    } else if(!strcmp(argv[i], "-oneshots") && i + 1 < argc) {
+      oneshot_variations = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-attack-cache") && i + 1 < argc) {
+      attack_cache_mib = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-workload") && i + 1 < argc) {
+      workload.kinds = rbnutil_workload_parse_kinds(argv[++i]);
+    } else if(!strcmp(argv[i], "-seed") && i + 1 < argc) {
+      workload.seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+    } else if(!strcmp(argv[i], "-duration") && i + 1 < argc) {
+      workload.duration_ms = (uint32_t)(atof(argv[++i]) * 1000.0);
+    } else if(!strcmp(argv[i], "-raw")) {
+      raw = 1;
+    } else if(!strcmp(argv[i], "-stems")) {
+      stems = 1;
+    } else if(!strcmp(argv[i], "-incremental")) {
+      incremental = 1;
+    } else if(!strcmp(argv[i], "-normalize")) {
+      normalize = 1;
+    } else if(!strcmp(argv[i], "-no-cache")) {
+      use_cache = 0;
+    } else if(!filename) {
+      filename = argv[i];
+    } else {
+      channel_mask = 1 << atoi(argv[i]);
+    }
+  }
 
-    const int64_t time_to_wait = current_msg->time - current_time;
-    if(time_to_wait > 0) {
-      const uint32_t samples_to_render = (uint32_t)((time_to_wait * sample_rate) / 1000);
+  // Incremental stems are rendered on their own instances, without one-shots, attack cache or trace
+  const int incremental_conflict = incremental && (oneshot_variations >= 0 || attack_cache_mib > 0 || trace_filename);
+  if(!filename || stems + incremental + normalize > 1 || incremental_conflict || workload.kinds == 0) {
+    rbncli_print_help(0, NULL);
+    return -1;
+  }
 
-      int16_t* buffer = malloc(samples_to_render * sizeof(int16_t) * 2);
+  // Streaming to stdout keeps it clean of any text
+  const int to_stdout = output_filename && !strcmp(output_filename, "-");
+  FILE* log = to_stdout ? stderr : stdout;
 
-      const uint64_t previous_time = rbncli_get_time();
+  render_source source;
+  if(open_source(&source, filename, &workload, use_cache) != 0) {
+    return -1;
+  }
 
-      rbn_output_config output_config = {
-        .left_buffer = buffer,
-        .right_buffer = buffer + 1,
-        .stride = 2,
-        .sample_count = samples_to_render,
-        .sample_format = rbn_s16,
-      };
+  char wavfilename[RBNCLI_PATH_MAX];
+  const int named = output_filename != NULL;
+  if(replace_extension(wavfilename, sizeof(wavfilename), named ? output_filename : filename, named ? NULL : raw ? ".pcm" : ".wav") != 0) {
+    close_source(&source);
+    return -1;
+  }
 
-      rbn_result result = rbn_render(&inst, &output_config);
+  render_output outputs = {0};
+  outputs.wav = rbncli_wav_open(wavfilename, raw);
+  if(!outputs.wav) {
+    close_source(&source);
+    return -1;
+  }
+  if(stems && open_stems(&outputs, to_stdout ? filename : wavfilename, raw) != 0) {
+    close_output(&outputs);
+    close_source(&source);
+    return -1;
+  }
 
-      if(result != rbn_success) {
-        printf("rbn_render failed\n");
-        tml_free(mid_seq);
-        fclose(wavfile);
-        return -1;
-      }
+  if(incremental) {
+    const int result = render_incremental(&source, channel_mask, outputs.wav, log);
+    close_source(&source);
+    if(close_output(&outputs) != 0) {
+      fprintf(log, "Couldn't write to file '%s'\n", wavfilename);
+      return -1;
+    }
+    return result;
+  }
 
-      total_rendering_time += rbncli_get_time() - previous_time;
+  render_spool* spool = NULL;
+  if(normalize) {
+    spool = calloc(1, sizeof(render_spool));
+    spool->file = tmpfile();
+    if(!spool->file) {
+      fprintf(log, "Couldn't create a temporary file\n");
+      free(spool);
+      close_source(&source);
+      close_output(&outputs);
+      return -1;
+    }
+  }
 
-      fwrite(buffer, sizeof(int16_t) * 2, samples_to_render, wavfile);
+  uint32_t progress = 0;
+  if(!to_stdout) {
+    rbncli_progress_bar(progress, NULL);
+  }
 
-      free(buffer);
+  rbn_reset(&inst);
 
-      current_sample += samples_to_render;
+  if(trace_filename && rbncli_trace_begin(trace_filename) != 0) {
+    if(spool) {
+      fclose(spool->file);
+      free(spool);
     }
+    close_source(&source);
+    close_output(&outputs);
+    return -1;
+  }
 
-    if((1 << current_msg->channel) & channel_mask) {
-      rbncli_send_tml_msg(&inst, current_msg);
+  // Neither is in use yet when allocating fails, so they only need to be freed
+  int setup_failed = 0;
+  void* oneshot_memory = NULL;
+  size_t oneshot_size = 0;
+  if(oneshot_variations >= 0) {
+    oneshot_size = rbn_oneshot_size(&inst, oneshot_variations);
+    oneshot_memory = malloc(oneshot_size);
+    if((!oneshot_memory && oneshot_size > 0) || rbn_oneshot_init(&inst, oneshot_memory, oneshot_size, oneshot_variations) != rbn_success) {
+      fprintf(log, "Couldn't allocate %u KiB for one-shots\n", (uint32_t)(oneshot_size / 1024 + 1));
+      setup_failed = 1;
+    }
+  }
+  void* attack_memory = NULL;
+#ifdef RBN_ATTACK_CACHE
+  const size_t attack_size = (size_t)attack_cache_mib << 20;
+  if(!setup_failed && attack_cache_mib > 0) {
+    attack_memory = malloc(attack_size);
+    if(!attack_memory) {
+      fprintf(log, "Couldn't allocate %d MiB for the attack cache\n", attack_cache_mib);
+      setup_failed = 1;
+    } else if(rbn_attack_cache_init(&inst, attack_memory, attack_size, RENDER_ATTACK_TIME) != rbn_success) {
+      fprintf(log, "Attack cache needs at least %u KiB\n", (uint32_t)(rbn_attack_cache_slot_size(&inst, RENDER_ATTACK_TIME) / 1024 + 1));
+    }
+  }
+#endif
+  if(setup_failed) {
+    free(oneshot_memory);
+    free(attack_memory);
+    if(trace_filename) {
+      rbncli_trace_end();
+    }
+    if(spool) {
+      fclose(spool->file);
+      free(spool);
     }
-    current_msg = current_msg->next;
+    close_source(&source);
+    close_output(&outputs);
+    return -1;
   }
 
-  rbncli_progress_bar(100, &progress);
+  rbn_sequence_output output = {
+    .buffer = {
+      .stride = 2,
+      .sample_format = spool ? rbn_f32_raw : rbn_s16,
+    },
+    .sink = spool ? write_to_spool : write_to_wav,
+    .user_data = spool ? (void*)spool : (void*)&outputs,
+    .stems = stems ? outputs.stems : NULL,
+  };
+  output.sink(output.user_data, &output.buffer, 0);
+
+  // Events are rendered in batches, which only need to be rebased on the batch start
+  uint32_t current_sample = 0;
+  uint64_t total_rendering_time = 0;
+  int done = 0;
+  while(!done) {
+    uint32_t event_count = 0;
+    uint32_t last_sample = current_sample;
+    rbn_event event;
+    while(event_count < RENDER_BATCH_EVENTS && !(done = next_event(&source, &event) != 0)) {
+      if(!to_stdout) {
+        rbncli_progress_bar(get_progress(&source), &progress);
+      }
+      // Events that go back in time are sent right away
+      if(event.sample > last_sample) {
+        last_sample = event.sample;
+      }
+      if((1 << event.msg.channel) & channel_mask) {
+        batch[event_count].sample = last_sample - current_sample;
+        batch[event_count].msg = event.msg;
+        event_count++;
+      }
+    }
 
-  const long file_size = ftell(wavfile);
+    const uint64_t previous_stall_time = get_stall_time(&outputs);
+    const uint64_t previous_time = rbncli_get_time();
+    output.sample_count = last_sample - current_sample;
+    const rbn_result result = rbn_render_sequence(&inst, batch, event_count, &output);
+    total_rendering_time += rbncli_get_time() - previous_time - (get_stall_time(&outputs) - previous_stall_time);
+
+    if(result != rbn_success) {
+      fprintf(log, "rbn_render_sequence failed\n");
+      rbn_refresh(&inst); // Stops using the one-shots
+      free(oneshot_memory);
+#ifdef RBN_ATTACK_CACHE
+      rbn_attack_cache_init(&inst, NULL, 0, 0.f);
+#endif
+      free(attack_memory);
+      if(trace_filename) {
+        rbncli_trace_end();
+      }
+      if(spool) {
+        fclose(spool->file);
+        free(spool);
+      }
+      close_source(&source);
+      close_output(&outputs);
+      return -1;
+    }
+    current_sample = last_sample;
+  }
+
+  uint64_t normalize_time = 0;
+  float peak = 0.f;
+  int spool_failed = 0;
+  if(spool) {
+    const uint64_t previous_time = rbncli_get_time();
+    spool_failed = write_spool_to_wav(spool, outputs.wav) != 0;
+    normalize_time = rbncli_get_time() - previous_time;
+    peak = spool->peak;
+    fclose(spool->file);
+    free(spool);
+  }
 
-  // Fix the data chunk header to contain the data size
-  fseek(wavfile, data_chunk_pos + 4, SEEK_SET);
-  fputui(file_size - data_chunk_pos + 8, 4, wavfile);
+  if(!to_stdout) {
+    rbncli_progress_bar(100, &progress);
+  }
+  if(oneshot_memory) {
+    rbn_refresh(&inst);
+    free(oneshot_memory);
+  }
+#ifdef RBN_ATTACK_CACHE
+  if(attack_memory) {
+    rbn_attack_cache_init(&inst, NULL, 0, 0.f);
+    free(attack_memory);
+  }
+#endif
 
-  // Fix the file header to contain the proper RIFF chunk size, which is (file size - 8) bytes
-  fseek(wavfile, 4, SEEK_SET);
-  fputui(file_size - 8, 4, wavfile);
+  if(trace_filename && rbncli_trace_end() != 0) {
+    fprintf(log, "Couldn't write to file '%s'\n", trace_filename);
+  }
 
-  tml_free(mid_seq);
-  fclose(wavfile);
+  const char* source_name = source.timeline.mapping ? "cached" : !source.midi ? "built" : use_cache && !source.cache.path[0] ? "parsed (cache disabled)" : "parsed";
+  const uint64_t stall_time = get_stall_time(&outputs);
+  const int write_failures = close_output(&outputs);
+  close_source(&source);
 
-  printf("Samples per us: %f\n", (double)inst.rendered_samples / (double)total_rendering_time);
+  if(write_failures > 0) {
+    fprintf(log, "Couldn't write %d of the output files\n", write_failures);
+    return -1;
+  }
+  if(spool_failed) {
+    fprintf(log, "Couldn't write to the temporary file\n");
+    return -1;
+  }
+
+  fprintf(log, "Samples per us: %f\n", (double)inst.rendered_samples / (double)total_rendering_time);
+  fprintf(log, "Event source: %s\n", source_name);
+  fprintf(log, "Writer stall ms: %f\n", (double)stall_time / 1000.0);
+  if(normalize) {
+    fprintf(log, "Peak: %f\n", (double)peak);
+    fprintf(log, "Normalize ms: %f\n", (double)normalize_time / 1000.0);
+  }
+  if(oneshot_variations >= 0) {
+    fprintf(log, "One-shot memory KiB: %u\n", (uint32_t)(oneshot_size / 1024));
+  }
+  rbncli_print_stats(log, &inst);
 
   return 0;
 }
@@ -0,0 +1,388 @@
+#include "rbncli.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVE_MAGIC 0x4a4e4252 // "RBNJ"
+#define SERVE_MAX_MIDI_SIZE (64 << 20)
+#define SERVE_BUFFER_FRAMES 4096
+#define POLL_INTERVAL 100 // In milliseconds
+
+// A job is a request header followed by a MIDI file, answered by a response header followed by
+// exactly sample_count frames of interleaved 16-bit stereo PCM. All fields are in host byte order
+typedef struct serve_request {
+  uint32_t magic;
+  uint32_t midi_size;
+  uint32_t channel_mask;
+  uint32_t reserved;
+} serve_request;
+
+typedef struct serve_response {
+  int32_t status; // Negative when the job failed, nothing follows then
+  uint32_t sample_rate;
+  uint32_t sample_count;
+  uint32_t reserved;
+} serve_response;
+
+typedef struct serve_worker {
+  rbn_instance* inst;
+  int listen_fd;
+  int16_t samples[SERVE_BUFFER_FRAMES * 2];
+  int fd; // Of the job being rendered
+  int error;
+  uint64_t jobs;
+  uint64_t failures;
+} serve_worker;
+
+static int read_full(int fd, void* data, size_t size) {
+  uint8_t* bytes = data;
+  while(size > 0) {
+    const ssize_t count = read(fd, bytes, size);
+    if(count <= 0) {
+      if(count < 0 && errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    bytes += count;
+    size -= count;
+  }
+  return 0;
+}
+
+// Blocks while the peer is not reading, which holds the renderer back as well
+static int write_full(int fd, const void* data, size_t size) {
+  const uint8_t* bytes = data;
+  while(size > 0) {
+    const ssize_t count = write(fd, bytes, size);
+    if(count <= 0) {
+      if(count < 0 && errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    bytes += count;
+    size -= count;
+  }
+  return 0;
+}
+
+static void write_to_socket(void* data, rbn_output_config* buffer, uint64_t sample_count) {
+  serve_worker* worker = data;
+  if(write_full(worker->fd, worker->samples, sample_count * 2 * sizeof(int16_t)) != 0) {
+    worker->error = 1;
+    return; // Without room, rendering stops
+  }
+  buffer->left_buffer = worker->samples;
+  buffer->right_buffer = worker->samples + 1;
+  buffer->sample_count = SERVE_BUFFER_FRAMES;
+}
+
+static int serve_job(serve_worker* worker, int fd) {
+  serve_request request;
+  if(read_full(fd, &request, sizeof(request)) != 0 || request.magic != SERVE_MAGIC || request.midi_size > SERVE_MAX_MIDI_SIZE) {
+    return -1;
+  }
+  uint8_t* midi_data = malloc(request.midi_size);
+  rbncli_timeline timeline;
+  serve_response response = {.status = -1, .sample_rate = sample_rate};
+  if(read_full(fd, midi_data, request.midi_size) != 0 || rbncli_timeline_load_memory(&timeline, midi_data, request.midi_size, sample_rate) != 0) {
+    free(midi_data);
+    write_full(fd, &response, sizeof(response));
+    return -1;
+  }
+  free(midi_data);
+
+  uint32_t event_count = 0;
+  for(uint32_t i = 0; i < timeline.event_count; i++) {
+    if((1 << timeline.events[i].msg.channel) & request.channel_mask) {
+      timeline.events[event_count++] = timeline.events[i];
+    }
+  }
+
+  response.status = 0;
+  response.sample_count = timeline.sample_count;
+  if(write_full(fd, &response, sizeof(response)) != 0) {
+    rbncli_timeline_free(&timeline);
+    return -1;
+  }
+
+  // Each job starts from the bank the server was started with
+  memcpy(worker->inst, &inst, sizeof(rbn_instance));
+
+  worker->fd = fd;
+  worker->error = 0;
+  rbn_sequence_output output = {
+    .buffer = {
+      .left_buffer = worker->samples,
+      .right_buffer = worker->samples + 1,
+      .stride = 2,
+      .sample_count = SERVE_BUFFER_FRAMES,
+      .sample_format = rbn_s16,
+    },
+    .sample_count = timeline.sample_count,
+    .sink = write_to_socket,
+    .user_data = worker,
+  };
+  const rbn_result result = rbn_render_sequence(worker->inst, timeline.events, event_count, &output);
+  rbncli_timeline_free(&timeline);
+  return result == rbn_success && !worker->error ? 0 : -1;
+}
+
+static void worker_thread(void* data) {
+  serve_worker* worker = data;
+  while(1) {
+    const int fd = accept(worker->listen_fd, NULL, NULL);
+    if(fd < 0) {
+      if(errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      break; // The listening socket was shut down
+    }
+    if(serve_job(worker, fd) != 0) {
+      worker->failures++;
+    }
+    worker->jobs++;
+    close(fd);
+  }
+}
+
+static int open_socket(const char* path, struct sockaddr_un* address) {
+  if(strlen(path) >= sizeof(address->sun_path)) {
+    fprintf(stderr, "Socket path too long '%s'\n", path);
+    return -1;
+  }
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  strcpy(address->sun_path, path);
+  return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+// Workers accept jobs on their own, each one rendering with its copy of the global instance
+int rbncli_serve(int argc, char** argv) {
+  const char* path = NULL;
+  long worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+  for(int i = 0; i < argc; i++) {
+    if(!strcmp(argv[i], "-workers") && i + 1 < argc) {
+      worker_count = atoi(argv[++i]);
+    } else if(!path) {
+      path = argv[i];
+    }
+  }
+  if(!path || worker_count < 1) {
+    rbncli_print_help(0, NULL);
+    return -1;
+  }
+
+  struct sockaddr_un address;
+  const int listen_fd = open_socket(path, &address);
+  unlink(path);
+  if(listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, 64) != 0) {
+    fprintf(stderr, "Couldn't listen on '%s'\n", path);
+    if(listen_fd >= 0) {
+      close(listen_fd);
+    }
+    return -1;
+  }
+
+  // Disconnected clients are noticed through write errors instead
+  signal(SIGPIPE, SIG_IGN);
+
+  serve_worker* workers = calloc(worker_count, sizeof(serve_worker));
+  void** threads = calloc(worker_count, sizeof(void*));
+  for(long i = 0; i < worker_count; i++) {
+    workers[i].inst = malloc(sizeof(rbn_instance));
+    workers[i].listen_fd = listen_fd;
+    threads[i] = rbncli_create_thread(worker_thread, workers + i);
+  }
+
+  printf("Serving on '%s' with %ld workers, press enter to stop\n", path, worker_count);
+  struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+  while(1) {
+    if(poll(&pfd, 1, POLL_INTERVAL) > 0) {
+      char c;
+      if(read(STDIN_FILENO, &c, 1) > 0) {
+        break;
+      }
+      pfd.fd = -1; // Closed, so the server runs until it is killed
+    }
+  }
+
+  shutdown(listen_fd, SHUT_RDWR);
+  uint64_t jobs = 0;
+  uint64_t failures = 0;
+  for(long i = 0; i < worker_count; i++) {
+    rbncli_join_thread(threads[i]);
+    jobs += workers[i].jobs;
+    failures += workers[i].failures;
+    free(workers[i].inst);
+  }
+  close(listen_fd);
+  unlink(path);
+  free(threads);
+  free(workers);
+
+  printf("Jobs: %" PRIu64 "\n", jobs);
+  printf("Failed jobs: %" PRIu64 "\n", failures);
+  return 0;
+}
+
+typedef struct loadtest {
+  const char* path;
+  const uint8_t* midi_data;
+  size_t midi_size;
+  uint32_t job_count;
+  uint32_t next_job;
+  uint32_t completed_jobs;
+  uint32_t failures;
+  uint64_t sample_count;
+  double* latencies; // In milliseconds, per completed job
+  double* first_byte_latencies;
+} loadtest;
+
+static int run_job(loadtest* test) {
+  const uint64_t start_time = rbncli_get_time();
+  struct sockaddr_un address;
+  const int fd = open_socket(test->path, &address);
+  if(fd < 0) {
+    return -1;
+  }
+  if(connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  serve_request request = {
+    .magic = SERVE_MAGIC,
+    .midi_size = (uint32_t)test->midi_size,
+    .channel_mask = ~0,
+  };
+  serve_response response;
+  if(write_full(fd, &request, sizeof(request)) != 0 || write_full(fd, test->midi_data, test->midi_size) != 0 ||
+    read_full(fd, &response, sizeof(response)) != 0 || response.status != 0) {
+    close(fd);
+    return -1;
+  }
+
+  // The rendered audio is read and dropped
+  int16_t samples[SERVE_BUFFER_FRAMES * 2];
+  uint64_t remaining = (uint64_t)response.sample_count * sizeof(int16_t) * 2;
+  double first_byte_latency = 0.0;
+  int first = 1;
+  while(remaining > 0) {
+    const ssize_t count = read(fd, samples, remaining < sizeof(samples) ? remaining : sizeof(samples));
+    if(count <= 0) {
+      close(fd);
+      return -1;
+    }
+    if(first) {
+      first_byte_latency = (double)(rbncli_get_time() - start_time) / 1000.0;
+      first = 0;
+    }
+    remaining -= count;
+  }
+  close(fd);
+
+  const uint32_t index = __atomic_fetch_add(&test->completed_jobs, 1, __ATOMIC_RELAXED);
+  test->latencies[index] = (double)(rbncli_get_time() - start_time) / 1000.0;
+  test->first_byte_latencies[index] = first_byte_latency;
+  test->sample_count = response.sample_count;
+  return 0;
+}
+
+static void client_thread(void* data) {
+  loadtest* test = data;
+  while(1) {
+    const uint32_t job = __atomic_fetch_add(&test->next_job, 1, __ATOMIC_RELAXED);
+    if(job >= test->job_count) {
+      break;
+    }
+    if(run_job(test) != 0) {
+      __atomic_fetch_add(&test->failures, 1, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static int compare_double(const void* a, const void* b) {
+  const double da = *(const double*)a;
+  const double db = *(const double*)b;
+  return (da > db) - (da < db);
+}
+
+static void print_latencies(const char* name, double* latencies, uint32_t count) {
+  qsort(latencies, count, sizeof(double), compare_double);
+  printf("%s ms (p50, p99, max): %.2f, %.2f, %.2f\n", name, latencies[count / 2], latencies[(count - 1) * 99 / 100], latencies[count - 1]);
+}
+
+// Sends the same file from several clients at once and measures how the server keeps up
+int rbncli_loadtest(int argc, char** argv) {
+  loadtest test = {0};
+  const char* filename = NULL;
+  uint32_t client_count = 4;
+  test.job_count = 100;
+  for(int i = 0; i < argc; i++) {
+    if(!strcmp(argv[i], "-clients") && i + 1 < argc) {
+      client_count = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-jobs") && i + 1 < argc) {
+      test.job_count = atoi(argv[++i]);
+    } else if(!test.path) {
+      test.path = argv[i];
+    } else {
+      filename = argv[i];
+    }
+  }
+  if(!test.path || !filename || client_count < 1 || test.job_count < 1) {
+    rbncli_print_help(0, NULL);
+    return -1;
+  }
+
+  test.midi_data = rbncli_map_file(filename, &test.midi_size);
+  if(!test.midi_data) {
+    fprintf(stderr, "Couldn't open file '%s'\n", filename);
+    return -1;
+  }
+  test.latencies = calloc(test.job_count, sizeof(double));
+  test.first_byte_latencies = calloc(test.job_count, sizeof(double));
+
+  void** threads = calloc(client_count, sizeof(void*));
+  const uint64_t start_time = rbncli_get_time();
+  for(uint32_t i = 0; i < client_count; i++) {
+    threads[i] = rbncli_create_thread(client_thread, &test);
+  }
+  for(uint32_t i = 0; i < client_count; i++) {
+    rbncli_join_thread(threads[i]);
+  }
+  const double elapsed = (double)(rbncli_get_time() - start_time) / 1000000.0;
+
+  printf("Jobs: %u\n", test.job_count);
+  printf("Failed jobs: %u\n", test.failures);
+  printf("Jobs per second: %.2f\n", test.job_count / elapsed);
+  if(test.completed_jobs > 0) {
+    printf("Realtime factor: %.1f\n", (double)test.sample_count * test.completed_jobs / sample_rate / elapsed);
+    print_latencies("Job latency", test.latencies, test.completed_jobs);
+    print_latencies("First audio latency", test.first_byte_latencies, test.completed_jobs);
+  }
+
+  free(threads);
+  free(test.latencies);
+  free(test.first_byte_latencies);
+  rbncli_unmap_file(test.midi_data, test.midi_size);
+  return test.failures > 0 ? -1 : 0;
+}
+#else
+int rbncli_serve(int argc, char** argv) {
+  printf("serve is not supported on this platform\n");
+  return -1;
+}
+
+int rbncli_loadtest(int argc, char** argv) {
+  printf("loadtest is not supported on this platform\n");
+  return -1;
+}
+#endif
@@ -0,0 +1,272 @@
+#include "rbncli.h"
+
+#include <math.h>
+#include <string.h>
+
+#define RBNCLI_STEM_MAGIC 0x534e4252 // "RBNS"
+#define RBNCLI_STEM_VERSION 2
+#define RBNCLI_STEM_BUDGET ((uint64_t)2 << 30) // Least recently used stems are removed past 2 GiB
+
+// Set by the build to a hash of the robin headers, otherwise any rebuild against them changes it
+#ifndef RBNCLI_SYNTH_HASH
+#define RBNCLI_SYNTH_HASH __DATE__ " " __TIME__
+#endif
+
+// Native endianness, raw interleaved float stereo frames follow
+typedef struct rbncli_stem_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t sample_count;
+  uint32_t frame_size;
+} rbncli_stem_header;
+
+// Each channel is rendered on its own instance, so that its stem only depends on what is hashed here:
+// the synthesis code, the configuration, the channel's initial state, its events and the programs its
+// notes start. Returns zero if the channel plays no note
+static uint64_t get_stem_key(const rbn_event* events, uint32_t event_count, uint32_t sample_count, uint8_t channel) {
+  const uint32_t version = RBNCLI_STEM_VERSION;
+  uint64_t hash = rbncli_hash(RBNCLI_SYNTH_HASH, sizeof(RBNCLI_SYNTH_HASH));
+  hash = rbncli_hash_continue(hash, &version, sizeof(version));
+  hash = rbncli_hash_continue(hash, &inst.config, sizeof(inst.config));
+  hash = rbncli_hash_continue(hash, &sample_count, sizeof(sample_count));
+  hash = rbncli_hash_continue(hash, inst.channels + channel, sizeof(rbn_channel));
+
+  uint8_t used[RBN_PROGRAM_COUNT] = {0};
+  uint8_t program = inst.channels[channel].program;
+  int has_notes = 0;
+  for(const rbn_event* event = events; event < events + event_count; event++) {
+    if(event->msg.channel != channel) {
+      continue;
+    }
+    hash = rbncli_hash_continue(hash, event, sizeof(rbn_event));
+    if(event->msg.type == rbn_program_change) {
+      program = event->msg.instrument;
+    } else if(event->msg.type == rbn_note_on && event->msg.velocity > 0) {
+      const uint32_t note_program = channel == RBN_KEYMAP_CHANNEL ? RBN_KEYMAP_OFFSET + event->msg.key : program;
+      if(note_program < RBN_PROGRAM_COUNT) {
+        used[note_program] = 1;
+        has_notes = 1;
+      }
+    }
+  }
+  if(!has_notes) {
+    return 0;
+  }
+
+  for(uint32_t i = 0; i < RBN_PROGRAM_COUNT; i++) {
+    if(used[i]) {
+      hash = rbncli_hash_continue(hash, &i, sizeof(i));
+      hash = rbncli_hash_continue(hash, inst.programs + i, sizeof(rbn_program));
+    }
+  }
+  return hash ? hash : 1;
+}
+
+static const float* map_stem(const char* path, uint64_t key, uint32_t sample_count, size_t* size) {
+  const uint8_t* data = rbncli_map_file(path, size);
+  if(!data) {
+    return NULL;
+  }
+
+  // Anything unexpected is treated as a miss and gets overwritten
+  const rbncli_stem_header* header = (const rbncli_stem_header*)data;
+  if(*size < sizeof(rbncli_stem_header)
+    || header->magic != RBNCLI_STEM_MAGIC
+    || header->version != RBNCLI_STEM_VERSION
+    || header->key != key
+    || header->sample_count != sample_count
+    || header->frame_size != sizeof(float) * 2
+    || *size != sizeof(rbncli_stem_header) + (size_t)sample_count * sizeof(float) * 2) {
+    rbncli_unmap_file(data, *size);
+    return NULL;
+  }
+  return (const float*)(data + sizeof(rbncli_stem_header));
+}
+
+// Returns null if the channel couldn't be rendered
+static float* render_stem(rbn_instance* stem_inst, const rbn_event* events, uint32_t event_count, uint32_t sample_count, uint8_t channel) {
+  rbn_event* channel_events = malloc(event_count * sizeof(rbn_event));
+  float* samples = malloc((size_t)sample_count * sizeof(float) * 2);
+  if(!channel_events || !samples) {
+    free(channel_events);
+    free(samples);
+    return NULL;
+  }
+  uint32_t channel_event_count = 0;
+  for(const rbn_event* event = events; event < events + event_count; event++) {
+    if(event->msg.channel == channel) {
+      channel_events[channel_event_count++] = *event;
+    }
+  }
+
+  memcpy(stem_inst, &inst, sizeof(rbn_instance));
+  rbn_reset(stem_inst);
+
+  rbn_sequence_output output = {
+    .buffer = {
+      .left_buffer = samples,
+      .right_buffer = samples + 1,
+      .stride = 2,
+      .sample_count = sample_count,
+      .sample_format = rbn_f32_raw,
+    },
+    .sample_count = sample_count,
+  };
+  const rbn_result result = rbn_render_sequence(stem_inst, channel_events, channel_event_count, &output);
+  free(channel_events);
+  if(result != rbn_success) {
+    free(samples);
+    return NULL;
+  }
+  return samples;
+}
+
+// Renaming last means readers never see a partial file
+static void write_stem(const char* path, uint64_t key, uint32_t sample_count, const float* samples) {
+  char tmp_path[512 + 4];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  FILE* file = fopen(tmp_path, "wb");
+  if(!file) {
+    return;
+  }
+
+  const rbncli_stem_header header = {
+    .magic = RBNCLI_STEM_MAGIC,
+    .version = RBNCLI_STEM_VERSION,
+    .key = key,
+    .sample_count = sample_count,
+    .frame_size = sizeof(float) * 2,
+  };
+  const int written = fwrite(&header, sizeof(header), 1, file) == 1
+    && fwrite(samples, sizeof(float) * 2, sample_count, file) == sample_count;
+  const int closed = fclose(file) == 0;
+  remove(path);
+  if(!written || !closed || rename(tmp_path, path) != 0) {
+    remove(tmp_path);
+  }
+}
+
+static int compare_file_time(const void* a, const void* b) {
+  const uint64_t ta = ((const rbncli_file*)a)->time;
+  const uint64_t tb = ((const rbncli_file*)b)->time;
+  return (ta > tb) - (ta < tb);
+}
+
+// Stems are touched when used, so the oldest are the least recently used
+static void evict_stems(const char* dir) {
+  uint32_t count;
+  rbncli_file* files = rbncli_list_files(dir, ".rbns", &count);
+  if(!files) {
+    return;
+  }
+  uint64_t total_size = 0;
+  for(uint32_t i = 0; i < count; i++) {
+    total_size += files[i].size;
+  }
+  qsort(files, count, sizeof(rbncli_file), compare_file_time);
+  for(uint32_t i = 0; i < count && total_size > RBNCLI_STEM_BUDGET; i++) {
+    char path[RBNCLI_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+    if(remove(path) == 0) {
+      total_size -= files[i].size;
+    }
+  }
+  free(files);
+}
+
+static void add_stem(float* mix, const float* stem, uint32_t sample_count) {
+  for(size_t i = 0; i < (size_t)sample_count * 2; i++) {
+    mix[i] += stem[i];
+  }
+}
+
+// Same normalization as robin applies to its own output, so that a mix of stems sounds like a render
+static void mix_stems(const float* mix, uint32_t sample_count, rbncli_wav* wav) {
+  float dynamic_range = 1.f;
+  uint32_t position = 0;
+  while(position < sample_count) {
+    uint32_t frame_count;
+    int16_t* output = rbncli_wav_get_buffer(wav, &frame_count);
+    if(frame_count > sample_count - position) {
+      frame_count = sample_count - position;
+    }
+    for(uint32_t i = position * 2; i < (position + frame_count) * 2; i++) {
+      const float sample = mix[i];
+      const float range = fabsf(sample) * 1.01f;
+      if(range > dynamic_range) {
+        dynamic_range = range;
+      }
+      *output++ = (int16_t)(sample / dynamic_range * 0x8000);
+    }
+    rbncli_wav_commit(wav, frame_count);
+    position += frame_count;
+  }
+}
+
+int rbncli_render_incremental(const rbn_event* events, uint32_t event_count, uint32_t sample_count, rbncli_wav* wav, FILE* log) {
+  char dir[448] = "";
+  const int use_cache = rbncli_get_cache_dir(dir, sizeof(dir)) == 0;
+  if(!use_cache) {
+    fprintf(log, "Stem cache disabled, no cache directory\n");
+  }
+
+  // Stems are summed as they come, so only one is held besides the mix
+  float* mix = calloc((size_t)sample_count * 2, sizeof(float));
+  rbn_instance* stem_inst = malloc(sizeof(rbn_instance));
+  if(!mix || !stem_inst) {
+    free(mix);
+    free(stem_inst);
+    fprintf(log, "Couldn't allocate the mix\n");
+    return -1;
+  }
+  uint32_t rendered_count = 0;
+  uint32_t cached_count = 0;
+
+  const uint64_t previous_time = rbncli_get_time();
+  for(uint8_t c = 0; c < RBN_CHAN_COUNT; c++) {
+    const uint64_t key = get_stem_key(events, event_count, sample_count, c);
+    if(key == 0) {
+      continue; // Silent
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%016" PRIx64 ".rbns", dir, key);
+    size_t mapping_size;
+    const float* stem = use_cache ? map_stem(path, key, sample_count, &mapping_size) : NULL;
+    if(stem) {
+      add_stem(mix, stem, sample_count);
+      rbncli_unmap_file((const uint8_t*)stem - sizeof(rbncli_stem_header), mapping_size);
+      rbncli_touch_file(path);
+      cached_count++;
+      continue;
+    }
+
+    float* samples = render_stem(stem_inst, events, event_count, sample_count, c);
+    if(!samples) {
+      fprintf(log, "Couldn't render channel %u\n", c);
+      free(stem_inst);
+      free(mix);
+      return -1;
+    }
+    if(use_cache) {
+      write_stem(path, key, sample_count, samples);
+    }
+    add_stem(mix, samples, sample_count);
+    free(samples);
+    rendered_count++;
+  }
+  const uint64_t render_time = rbncli_get_time() - previous_time;
+  free(stem_inst);
+
+  mix_stems(mix, sample_count, wav);
+  free(mix);
+  if(use_cache && rendered_count > 0) {
+    evict_stems(dir);
+  }
+
+  fprintf(log, "Channels rendered: %u\n", rendered_count);
+  fprintf(log, "Channels cached: %u\n", cached_count);
+  fprintf(log, "Render ms: %f\n", (double)render_time / 1000.0);
+  return 0;
+}
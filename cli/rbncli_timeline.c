@@ -0,0 +1,41 @@
+#include "rbncli.h"
+
+#include <string.h>
+
+static int load_midi(rbncli_timeline* timeline, rbncli_midi* midi) {
+  memset(timeline, 0, sizeof(*timeline));
+  if(!midi) {
+    return -1;
+  }
+
+  uint32_t capacity = 0;
+  rbn_event event;
+  while(rbncli_midi_next(midi, &event) == 0) {
+    if(timeline->event_count == capacity) {
+      capacity = capacity ? capacity * 2 : 1024;
+      timeline->events = realloc(timeline->events, capacity * sizeof(rbn_event));
+    }
+    timeline->events[timeline->event_count++] = event;
+    timeline->sample_count = event.sample;
+  }
+
+  rbncli_midi_close(midi);
+  return timeline->event_count > 0 ? 0 : -1;
+}
+
+int rbncli_timeline_load_memory(rbncli_timeline* timeline, const uint8_t* data, size_t size, uint32_t sample_rate) {
+  return load_midi(timeline, rbncli_midi_open_memory(data, size, sample_rate));
+}
+
+int rbncli_timeline_load_file(rbncli_timeline* timeline, const char* filename, uint32_t sample_rate) {
+  return load_midi(timeline, rbncli_midi_open_file(filename, sample_rate));
+}
+
+void rbncli_timeline_free(rbncli_timeline* timeline) {
+  if(timeline->mapping) {
+    rbncli_unmap_file(timeline->mapping, timeline->mapping_size);
+  } else {
+    free(timeline->events);
+  }
+  memset(timeline, 0, sizeof(*timeline));
+}
@@ -0,0 +1,154 @@
+#include "rbncli.h"
+
+#include <string.h>
+
+// Records are kept in memory while tracing and only formatted as Chrome trace-event JSON
+// at the end, so that the traced code does not pay for writing the file. The buffer is allocated
+// up front since records are added from the audio callback, and recording stops once it is full
+#define TRACE_MAX_RECORDS (1 << 22)
+
+typedef enum trace_kind {
+  trace_block,
+  trace_voice,
+  trace_voice_count,
+  trace_msg,
+} trace_kind;
+
+typedef struct trace_record {
+  uint64_t time; // In nanoseconds since the start of the trace
+  uint64_t data;
+  uint32_t duration; // In nanoseconds
+  uint32_t kind;
+} trace_record;
+
+int rbncli_tracing = 0;
+
+static FILE* trace_file;
+static trace_record* records;
+static uint32_t record_count;
+static uint32_t dropped_records;
+static uint64_t start_time;
+static uint64_t block_start_time;
+static uint64_t block_sample_index;
+static uint64_t voice_start_time;
+static uint32_t voice_count;
+
+static void add_record(trace_kind kind, uint64_t time, uint32_t duration, uint64_t data) {
+  if(record_count == TRACE_MAX_RECORDS) {
+    dropped_records++;
+    return;
+  }
+  trace_record* record = records + record_count++;
+  record->time = time;
+  record->data = data;
+  record->duration = duration;
+  record->kind = kind;
+}
+
+int rbncli_trace_begin(const char* filename) {
+  trace_file = fopen(filename, "w");
+  if(!trace_file) {
+    fprintf(stderr, "Couldn't write to file '%s'\n", filename);
+    return -1;
+  }
+  records = malloc(TRACE_MAX_RECORDS * sizeof(trace_record));
+  if(!records) {
+    fprintf(stderr, "Couldn't allocate the trace buffer\n");
+    fclose(trace_file);
+    return -1;
+  }
+  record_count = 0;
+  dropped_records = 0;
+  start_time = rbncli_get_time_ns();
+  rbncli_tracing = 1;
+  return 0;
+}
+
+void rbncli_trace_block_begin(uint64_t sample_index) {
+  block_sample_index = sample_index;
+  voice_count = 0;
+  block_start_time = rbncli_get_time_ns() - start_time;
+}
+
+void rbncli_trace_block_end() {
+  const uint64_t time = rbncli_get_time_ns() - start_time;
+  add_record(trace_block, block_start_time, (uint32_t)(time - block_start_time), block_sample_index);
+  add_record(trace_voice_count, block_start_time, 0, voice_count);
+}
+
+void rbncli_trace_voice_begin() {
+  voice_start_time = rbncli_get_time_ns() - start_time;
+}
+
+void rbncli_trace_voice_end(uint8_t program, uint8_t key, uint8_t channel) {
+  const uint64_t time = rbncli_get_time_ns() - start_time;
+  add_record(trace_voice, voice_start_time, (uint32_t)(time - voice_start_time), program | (key << 8) | (channel << 16));
+  voice_count++;
+}
+
+void rbncli_trace_msg(rbn_msg msg) {
+  add_record(trace_msg, rbncli_get_time_ns() - start_time, 0, msg.u32);
+}
+
+static void write_msg(FILE* file, const trace_record* record) {
+  rbn_msg msg;
+  msg.u32 = (uint32_t)record->data;
+
+  const char* names[7] = {"note off", "note on", "key pressure", "control change", "program change", "channel pressure", "pitch bend"};
+  const char* name = msg.type >= rbn_note_off && msg.type < 0xf0 ? names[(msg.type >> 4) - 8] : "message";
+  fprintf(file, "{\"name\":\"%s\",\"cat\":\"midi\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"args\":{\"channel\":%u,", name, (double)record->time / 1000.0, msg.channel);
+  switch(msg.type) {
+    case rbn_note_off:
+    case rbn_note_on:
+      fprintf(file, "\"key\":%u,\"velocity\":%u}}", msg.key, msg.velocity);
+      break;
+    case rbn_control_change:
+      fprintf(file, "\"control\":%u,\"value\":%u}}", msg.control, msg.value);
+      break;
+    case rbn_program_change:
+      fprintf(file, "\"program\":%u}}", msg.instrument);
+      break;
+    default:
+      fprintf(file, "\"type\":%u,\"data\":[%u,%u]}}", msg.type, msg.u8[2], msg.u8[3]);
+      break;
+  }
+}
+
+int rbncli_trace_end() {
+  rbncli_tracing = 0;
+
+  FILE* file = trace_file;
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"render\"}},\n");
+  fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"midi\"}}");
+  for(const trace_record* record = records; record < records + record_count; record++) {
+    fprintf(file, ",\n");
+    const double time = (double)record->time / 1000.0;
+    const double duration = (double)record->duration / 1000.0;
+    switch(record->kind) {
+      case trace_block:
+        fprintf(file, "{\"name\":\"block\",\"cat\":\"render\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"sample\":%" PRIu64 "}}", time, duration, record->data);
+        break;
+      case trace_voice:
+        fprintf(file, "{\"name\":\"program %u\",\"cat\":\"voice\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"program\":%u,\"key\":%u,\"channel\":%u}}",
+          (uint32_t)(record->data & 0xff), time, duration, (uint32_t)(record->data & 0xff), (uint32_t)((record->data >> 8) & 0xff), (uint32_t)(record->data >> 16));
+        break;
+      case trace_voice_count:
+        fprintf(file, "{\"name\":\"active voices\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"voices\":%" PRIu64 "}}", time, record->data);
+        break;
+      case trace_msg:
+        write_msg(file, record);
+        break;
+    }
+  }
+  fprintf(file, "\n]}\n");
+
+  const int result = ferror(file) ? -1 : 0;
+  fclose(file);
+  free(records);
+  records = NULL;
+  if(dropped_records > 0) {
+    fprintf(stderr, "Trace buffer full, the last %u records were dropped\n", dropped_records);
+  }
+  return result;
+}
@@ -1,9 +1,16 @@
 #include "rbncli.h"
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
+#include <utime.h>
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -11,12 +18,108 @@ void rbncli_platform_init() {
   pthread_mutex_init(&mutex, NULL);
 }
 
+void rbncli_set_binary_mode(FILE* file) {
+  (void)file; // No distinction between text and binary streams
+}
+
+const void* rbncli_map_file(const char* filename, size_t* size) {
+  const int fd = open(filename, O_RDONLY);
+  if(fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  void* data = MAP_FAILED;
+  if(fstat(fd, &st) == 0 && st.st_size > 0) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd); // The mapping keeps its own reference
+  if(data == MAP_FAILED) {
+    return NULL;
+  }
+  *size = st.st_size;
+  return data;
+}
+
+void rbncli_unmap_file(const void* data, size_t size) {
+  munmap((void*)data, size);
+}
+
+int rbncli_get_cache_dir(char* path, size_t size) {
+  const char* xdg_cache = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if(xdg_cache && xdg_cache[0]) {
+    snprintf(path, size, "%s", xdg_cache);
+    mkdir(path, 0755);
+  } else if(home && home[0]) {
+    snprintf(path, size, "%s/.cache", home);
+    mkdir(path, 0755);
+  } else {
+    return -1;
+  }
+  strncat(path, "/robin", size - strlen(path) - 1);
+  mkdir(path, 0755);
+
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode) ? 0 : -1;
+}
+
+rbncli_file* rbncli_list_files(const char* dir, const char* extension, uint32_t* count) {
+  DIR* handle = opendir(dir);
+  if(!handle) {
+    return NULL;
+  }
+  rbncli_file* files = NULL;
+  uint32_t capacity = 0;
+  *count = 0;
+  const size_t extension_length = strlen(extension);
+  struct dirent* entry;
+  while((entry = readdir(handle))) {
+    const size_t length = strlen(entry->d_name);
+    if(length < extension_length || length >= sizeof(files->name) || strcmp(entry->d_name + length - extension_length, extension)) {
+      continue;
+    }
+    char path[RBNCLI_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    struct stat st;
+    if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    if(*count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      rbncli_file* grown = realloc(files, capacity * sizeof(rbncli_file));
+      if(!grown) {
+        closedir(handle);
+        free(files);
+        *count = 0;
+        return NULL;
+      }
+      files = grown;
+    }
+    rbncli_file* file = files + (*count)++;
+    strcpy(file->name, entry->d_name);
+    file->size = (uint64_t)st.st_size;
+    file->time = (uint64_t)st.st_mtime;
+  }
+  closedir(handle);
+  return files ? files : calloc(1, sizeof(rbncli_file));
+}
+
+void rbncli_touch_file(const char* path) {
+  utime(path, NULL);
+}
+
 uint64_t rbncli_get_time() {
   struct timeval tv;
   gettimeofday(&tv, NULL);
   return (uint64_t)tv.tv_usec + (uint64_t)tv.tv_sec * 1000000;
 }
 
+uint64_t rbncli_get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_nsec + (uint64_t)ts.tv_sec * 1000000000;
+}
+
 void rbncli_sleep(uint32_t ms) {
   usleep(ms * 1000);
 }
@@ -29,6 +132,74 @@ void rbncli_unlock() {
   pthread_mutex_unlock(&mutex);
 }
 
+typedef struct rbncli_thread {
+  pthread_t handle;
+  void (*func)(void*);
+  void* data;
+} rbncli_thread;
+
+static void* thread_entry(void* data) {
+  rbncli_thread* thread = data;
+  thread->func(thread->data);
+  return NULL;
+}
+
+void* rbncli_create_thread(void (*func)(void*), void* data) {
+  rbncli_thread* thread = malloc(sizeof(rbncli_thread));
+  thread->func = func;
+  thread->data = data;
+  if(pthread_create(&thread->handle, NULL, thread_entry, thread) != 0) {
+    free(thread);
+    return NULL;
+  }
+  return thread;
+}
+
+void rbncli_join_thread(void* thread) {
+  pthread_join(((rbncli_thread*)thread)->handle, NULL);
+  free(thread);
+}
+
+// Unnamed POSIX semaphores are not available everywhere (macOS), so count by hand
+typedef struct rbncli_semaphore {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint32_t count;
+} rbncli_semaphore;
+
+void* rbncli_create_semaphore(uint32_t count) {
+  rbncli_semaphore* semaphore = malloc(sizeof(rbncli_semaphore));
+  pthread_mutex_init(&semaphore->mutex, NULL);
+  pthread_cond_init(&semaphore->cond, NULL);
+  semaphore->count = count;
+  return semaphore;
+}
+
+void rbncli_wait_semaphore(void* data) {
+  rbncli_semaphore* semaphore = data;
+  pthread_mutex_lock(&semaphore->mutex);
+  while(semaphore->count == 0) {
+    pthread_cond_wait(&semaphore->cond, &semaphore->mutex);
+  }
+  semaphore->count--;
+  pthread_mutex_unlock(&semaphore->mutex);
+}
+
+void rbncli_post_semaphore(void* data) {
+  rbncli_semaphore* semaphore = data;
+  pthread_mutex_lock(&semaphore->mutex);
+  semaphore->count++;
+  pthread_cond_signal(&semaphore->cond);
+  pthread_mutex_unlock(&semaphore->mutex);
+}
+
+void rbncli_destroy_semaphore(void* data) {
+  rbncli_semaphore* semaphore = data;
+  pthread_cond_destroy(&semaphore->cond);
+  pthread_mutex_destroy(&semaphore->mutex);
+  free(semaphore);
+}
+
 void rbncli_clear_screen() {
   system("clear");
 }
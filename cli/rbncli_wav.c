@@ -0,0 +1,200 @@
+#include "rbncli.h"
+
+#include <string.h>
+
+#define RBNCLI_WAV_BUFFER_COUNT 4
+#define RBNCLI_WAV_BUFFER_FRAMES (1 << 16)
+#define RBNCLI_WAV_CHANNELS 2
+
+typedef struct rbncli_wav_buffer {
+  int16_t* samples;
+  uint32_t frame_count;
+} rbncli_wav_buffer;
+
+struct rbncli_wav {
+  FILE* file;
+  long data_chunk_pos; // Negative when there is no header to fix on close
+  int error;
+
+  // Buffers are filled and flushed in round-robin order
+  rbncli_wav_buffer buffers[RBNCLI_WAV_BUFFER_COUNT];
+  uint32_t render_index;
+  uint32_t write_index;
+  void* free_semaphore;
+  void* full_semaphore;
+  void* thread;
+
+  uint64_t stall_time;
+};
+
+static void fputui(unsigned int value, size_t size, FILE* stream) {
+  while(size > 0) {
+    fputc(value & 0xff, stream);
+    size -= 1;
+    value >>= 8;
+  }
+}
+
+static uint8_t* putui(uint8_t* dest, uint32_t value, size_t size) {
+  while(size > 0) {
+    *dest++ = value & 0xff;
+    size -= 1;
+    value >>= 8;
+  }
+  return dest;
+}
+
+static uint8_t* putstr(uint8_t* dest, const char* str) {
+  const size_t len = strlen(str);
+  memcpy(dest, str, len);
+  return dest + len;
+}
+
+static void writer_thread(void* data) {
+  rbncli_wav* wav = data;
+  while(1) {
+    rbncli_wait_semaphore(wav->full_semaphore);
+    rbncli_wav_buffer* buffer = wav->buffers + wav->write_index;
+    wav->write_index = (wav->write_index + 1) % RBNCLI_WAV_BUFFER_COUNT;
+
+    // An empty buffer signals the end of the stream
+    if(buffer->frame_count == 0) {
+      break;
+    }
+
+    // Flushed right away so that readers of a pipe get each buffer as soon as it is rendered
+    if(!wav->error && (fwrite(buffer->samples, sizeof(int16_t) * RBNCLI_WAV_CHANNELS, buffer->frame_count, wav->file) != buffer->frame_count
+      || fflush(wav->file) != 0)) {
+      wav->error = 1;
+    }
+    buffer->frame_count = 0;
+
+    rbncli_post_semaphore(wav->free_semaphore);
+  }
+}
+
+rbncli_wav* rbncli_wav_open(const char* filename, int raw) {
+  FILE* file;
+  if(!strcmp(filename, "-")) {
+    file = stdout;
+    rbncli_set_binary_mode(file);
+  } else {
+    file = fopen(filename, "wb");
+  }
+  if(!file) {
+    fprintf(stderr, "Couldn't write to file '%s'\n", filename);
+    return NULL;
+  }
+
+  rbncli_wav* wav = calloc(1, sizeof(rbncli_wav));
+  wav->file = file;
+  wav->data_chunk_pos = -1;
+
+  const uint32_t bytes_per_block = sizeof(int16_t) * RBNCLI_WAV_CHANNELS;
+  const uint32_t bits_per_sample = sizeof(int16_t) * 8;
+  const uint32_t bytes_per_second = (sample_rate * bits_per_sample * RBNCLI_WAV_CHANNELS) / 8;
+
+  if(!raw) {
+    // Pipes and FIFOs cannot seek back to fix the sizes, so they are left at their maximum
+    // value which is commonly understood as unknown length
+    const int seekable = fseek(file, 0, SEEK_SET) == 0;
+    const char* unknown_size = "\xff\xff\xff\xff";
+
+    // Built whole so that it takes a single write
+    uint8_t header[44];
+    uint8_t* cur = header;
+    cur = putstr(cur, "RIFF");
+    cur = putstr(cur, seekable ? "----" : unknown_size);
+    cur = putstr(cur, "WAVEfmt ");
+    cur = putui(cur, 16, 4); // No extension data
+    cur = putui(cur, 1, 2); // PCM
+    cur = putui(cur, RBNCLI_WAV_CHANNELS, 2); // Channels
+    cur = putui(cur, sample_rate, 4); // Sample rate
+    cur = putui(cur, bytes_per_second, 4); // Byte rate
+    cur = putui(cur, bytes_per_block, 2); // Bytes per block
+    cur = putui(cur, bits_per_sample, 2); // Bits per sample
+    if(seekable) {
+      wav->data_chunk_pos = (long)(cur - header);
+    }
+    cur = putstr(cur, "data");
+    cur = putstr(cur, seekable ? "----" : unknown_size);
+    if(fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+      wav->error = 1;
+    }
+  }
+
+  for(uintptr_t i = 0; i < RBNCLI_WAV_BUFFER_COUNT; i++) {
+    wav->buffers[i].samples = malloc(RBNCLI_WAV_BUFFER_FRAMES * bytes_per_block);
+  }
+
+  wav->free_semaphore = rbncli_create_semaphore(RBNCLI_WAV_BUFFER_COUNT - 1);
+  wav->full_semaphore = rbncli_create_semaphore(0);
+  wav->thread = rbncli_create_thread(writer_thread, wav);
+
+  return wav;
+}
+
+int16_t* rbncli_wav_get_buffer(rbncli_wav* wav, uint32_t* frame_count) {
+  rbncli_wav_buffer* buffer = wav->buffers + wav->render_index;
+  *frame_count = RBNCLI_WAV_BUFFER_FRAMES - buffer->frame_count;
+  return buffer->samples + buffer->frame_count * RBNCLI_WAV_CHANNELS;
+}
+
+static void submit_buffer(rbncli_wav* wav) {
+  rbncli_post_semaphore(wav->full_semaphore);
+  wav->render_index = (wav->render_index + 1) % RBNCLI_WAV_BUFFER_COUNT;
+
+  // Only blocks if the writer thread is lagging behind
+  const uint64_t previous_time = rbncli_get_time();
+  rbncli_wait_semaphore(wav->free_semaphore);
+  wav->stall_time += rbncli_get_time() - previous_time;
+}
+
+void rbncli_wav_commit(rbncli_wav* wav, uint32_t frame_count) {
+  rbncli_wav_buffer* buffer = wav->buffers + wav->render_index;
+  buffer->frame_count += frame_count;
+  if(buffer->frame_count == RBNCLI_WAV_BUFFER_FRAMES) {
+    submit_buffer(wav);
+  }
+}
+
+uint64_t rbncli_wav_get_stall_time(const rbncli_wav* wav) {
+  return wav->stall_time;
+}
+
+int rbncli_wav_close(rbncli_wav* wav) {
+  if(wav->buffers[wav->render_index].frame_count > 0) {
+    submit_buffer(wav);
+  }
+  rbncli_post_semaphore(wav->full_semaphore); // Empty buffer stops the writer thread
+  rbncli_join_thread(wav->thread);
+
+  FILE* file = wav->file;
+  if(wav->data_chunk_pos >= 0) {
+    const long file_size = ftell(file);
+
+    // Fix the data chunk header to contain the data size
+    fseek(file, wav->data_chunk_pos + 4, SEEK_SET);
+    fputui(file_size - wav->data_chunk_pos + 8, 4, file);
+
+    // Fix the file header to contain the proper RIFF chunk size, which is (file size - 8) bytes
+    fseek(file, 4, SEEK_SET);
+    fputui(file_size - 8, 4, file);
+  }
+
+  const int result = wav->error ? -1 : 0;
+
+  if(file == stdout) {
+    fflush(file);
+  } else {
+    fclose(file);
+  }
+  rbncli_destroy_semaphore(wav->free_semaphore);
+  rbncli_destroy_semaphore(wav->full_semaphore);
+  for(uintptr_t i = 0; i < RBNCLI_WAV_BUFFER_COUNT; i++) {
+    free(wav->buffers[i].samples);
+  }
+  free(wav);
+
+  return result;
+}
@@ -2,6 +2,9 @@
 
 #include <Windows.h>
 #include <conio.h>
+#include <fcntl.h>
+#include <io.h>
+#include <string.h>
 
 static double perfcounter_mult;
 static CRITICAL_SECTION critical_section;
@@ -15,12 +18,105 @@ void rbncli_platform_init() {
   InitializeCriticalSectionAndSpinCount(&critical_section, 1024);
 }
 
+void rbncli_set_binary_mode(FILE* file) {
+  _setmode(_fileno(file), _O_BINARY);
+}
+
+const void* rbncli_map_file(const char* filename, size_t* size) {
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+  LARGE_INTEGER file_size;
+  void* data = NULL;
+  if(GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping) {
+      data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping); // The view keeps its own reference
+    }
+  }
+  CloseHandle(file);
+  if(data) {
+    *size = (size_t)file_size.QuadPart;
+  }
+  return data;
+}
+
+void rbncli_unmap_file(const void* data, size_t size) {
+  UnmapViewOfFile(data);
+}
+
+int rbncli_get_cache_dir(char* path, size_t size) {
+  const char* local_app_data = getenv("LOCALAPPDATA");
+  if(!local_app_data || !local_app_data[0]) {
+    return -1;
+  }
+  snprintf(path, size, "%s\\robin", local_app_data);
+  CreateDirectoryA(path, NULL);
+
+  const DWORD attributes = GetFileAttributesA(path);
+  return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) ? 0 : -1;
+}
+
+rbncli_file* rbncli_list_files(const char* dir, const char* extension, uint32_t* count) {
+  char pattern[RBNCLI_PATH_MAX];
+  snprintf(pattern, sizeof(pattern), "%s\\*%s", dir, extension);
+  WIN32_FIND_DATAA data;
+  HANDLE handle = FindFirstFileA(pattern, &data);
+  *count = 0;
+  if(handle == INVALID_HANDLE_VALUE) {
+    return GetLastError() == ERROR_FILE_NOT_FOUND ? calloc(1, sizeof(rbncli_file)) : NULL;
+  }
+  rbncli_file* files = NULL;
+  uint32_t capacity = 0;
+  do {
+    if((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || strlen(data.cFileName) >= sizeof(files->name)) {
+      continue;
+    }
+    if(*count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      rbncli_file* grown = realloc(files, capacity * sizeof(rbncli_file));
+      if(!grown) {
+        FindClose(handle);
+        free(files);
+        *count = 0;
+        return NULL;
+      }
+      files = grown;
+    }
+    rbncli_file* file = files + (*count)++;
+    strcpy(file->name, data.cFileName);
+    file->size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    file->time = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+  } while(FindNextFileA(handle, &data));
+  FindClose(handle);
+  return files ? files : calloc(1, sizeof(rbncli_file));
+}
+
+void rbncli_touch_file(const char* path) {
+  HANDLE file = CreateFileA(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(file == INVALID_HANDLE_VALUE) {
+    return;
+  }
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  SetFileTime(file, NULL, NULL, &now);
+  CloseHandle(file);
+}
+
 uint64_t rbncli_get_time() {
   int64_t counter;
   QueryPerformanceCounter((LARGE_INTEGER*)&counter);
   return (uint64_t)(counter * perfcounter_mult);
 }
 
+uint64_t rbncli_get_time_ns() {
+  int64_t counter;
+  QueryPerformanceCounter((LARGE_INTEGER*)&counter);
+  return (uint64_t)(counter * perfcounter_mult * 1000.0);
+}
+
 void rbncli_sleep(uint32_t ms) {
   Sleep(ms);
 }
@@ -33,6 +129,52 @@ void rbncli_unlock() {
   LeaveCriticalSection(&critical_section);
 }
 
+typedef struct rbncli_thread {
+  HANDLE handle;
+  void (*func)(void*);
+  void* data;
+} rbncli_thread;
+
+static DWORD WINAPI thread_entry(LPVOID data) {
+  rbncli_thread* thread = data;
+  thread->func(thread->data);
+  return 0;
+}
+
+void* rbncli_create_thread(void (*func)(void*), void* data) {
+  rbncli_thread* thread = malloc(sizeof(rbncli_thread));
+  thread->func = func;
+  thread->data = data;
+  thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+  if(thread->handle == NULL) {
+    free(thread);
+    return NULL;
+  }
+  return thread;
+}
+
+void rbncli_join_thread(void* thread) {
+  WaitForSingleObject(((rbncli_thread*)thread)->handle, INFINITE);
+  CloseHandle(((rbncli_thread*)thread)->handle);
+  free(thread);
+}
+
+void* rbncli_create_semaphore(uint32_t count) {
+  return CreateSemaphore(NULL, count, LONG_MAX, NULL);
+}
+
+void rbncli_wait_semaphore(void* semaphore) {
+  WaitForSingleObject(semaphore, INFINITE);
+}
+
+void rbncli_post_semaphore(void* semaphore) {
+  ReleaseSemaphore(semaphore, 1, NULL);
+}
+
+void rbncli_destroy_semaphore(void* semaphore) {
+  CloseHandle(semaphore);
+}
+
 void rbncli_clear_screen() {
   system("cls");
 }
@@ -120,11 +120,7 @@ void RobinAudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::M
     rbn_render(&robinInstance, &outputConfig);
     currentSample = metadata.samplePosition;
 
-    juce::MidiMessage juceMessage = metadata.getMessage();
-    rbn_msg robinMessage {};
-    // The channel data is omitted so the first byte is offset by one
-    memcpy(robinMessage.u8 + 1, juceMessage.getRawData(), 3);
-    rbn_send_msg(&robinInstance, robinMessage);
+    rbn_send_bytes(&robinInstance, metadata.data, metadata.numBytes);
   }
 
   outputConfig.sample_count = buffer.getNumSamples() - currentSample;
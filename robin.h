@@ -6,6 +6,7 @@
 #ifndef ROBIN_H
 #define ROBIN_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -44,6 +45,10 @@ extern "C" {
 
 #ifndef RBN_BLOCK_SAMPLES
 #define RBN_BLOCK_SAMPLES 64
+#endif
+
+#ifndef RBN_STATS_HISTOGRAM_BUCKETS
+#define RBN_STATS_HISTOGRAM_BUCKETS 32
 #endif
 
   typedef enum rbn_result {
@@ -52,11 +57,13 @@ extern "C" {
     rbn_unknown_control,
     rbn_unknown_sample_format,
     rbn_out_of_voice,
+    rbn_buffer_too_small,
   } rbn_result;
 
   typedef enum rbn_sample_format {
     rbn_f32,
     rbn_s16,
+    rbn_f32_raw, // Not normalized, for mixing outside of robin
   } rbn_sample_format;
 
   typedef enum rbn_msg_type {
@@ -136,6 +143,13 @@ extern "C" {
     uint64_t release_index;
     uint64_t inactive_index;
     rbn_program* program;
+#ifdef RBN_KEYMAP_CHANNEL
+    const float* oneshot; // Played back instead of synthesizing the program when set
+#endif
+#ifdef RBN_ATTACK_CACHE
+    struct rbn_attack_slot* attack; // Played back, or recorded into when recording is set
+    uint8_t recording;
+#endif
     float base_freq_rate;
     float velocity;
     uint8_t channel;
@@ -168,10 +182,80 @@ extern "C" {
     };
   } rbn_msg;
 
+#ifdef RBN_KEYMAP_CHANNEL
+  // A keymapped program rendered ahead at full velocity, without channel volume or pitch bend
+  typedef struct rbn_oneshot {
+    const float* samples; // Null when the program is synthesized, variations follow each other
+    uint32_t sample_count; // Of each variation, a multiple of RBN_BLOCK_SAMPLES
+    uint32_t variation_count;
+  } rbn_oneshot;
+#endif
+
+#ifdef RBN_ATTACK_CACHE
+  // Header of a slot in the attack cache memory. It is followed by the voice state at the start of each
+  // block, with one more for the handoff after the last one, then by the mono samples of each block
+  typedef struct rbn_attack_slot {
+    uint64_t last_use; // One past the sample index of the last note it started, zero when free
+    float base_freq_rate; // Key and pitch bend the attack was recorded with
+    uint32_t block_count; // Recorded so far
+    uint32_t attack_blocks; // To record
+    uint16_t program; // RBN_PROGRAM_COUNT when free
+  } rbn_attack_slot;
+
+  typedef struct rbn_attack_cache {
+    uint8_t* memory; // Null when disabled
+    size_t slot_size;
+    uint32_t slot_count;
+    uint32_t slot_blocks;
+  } rbn_attack_cache;
+#endif
+
   typedef struct rbn_config {
     uint32_t sample_rate;
+    uint32_t seed; // Of the noise generator, zero picks a fixed default
   } rbn_config;
 
+  // State of a raw MIDI byte stream, so that messages can be split across buffers
+  typedef struct rbn_parser {
+    uint8_t status; // Running status, zero when data bytes should be ignored
+    uint8_t data[2];
+    uint8_t data_count;
+  } rbn_parser;
+
+#ifdef RBN_STATS
+  // Written by the rendering thread only, readable from any thread through rbn_get_stats
+  // Each field is read atomically but fields are not a consistent snapshot of each other
+  typedef struct rbn_stats {
+    uint64_t active_voices; // During the last block
+    uint64_t peak_voices;
+    uint64_t voice_allocation_failures;
+    uint64_t messages[8]; // Indexed by (type >> 4) - 8 for channel messages, last one for others
+    uint64_t voice_blocks;
+    uint64_t blocks; // Rendered with at least one voice, the only ones timed
+    uint64_t idle_blocks; // Skipped without any voice to render
+    uint64_t max_block_time; // In nanoseconds
+    uint64_t block_time_histogram[RBN_STATS_HISTOGRAM_BUCKETS]; // Bucket i counts blocks that took [2^i, 2^(i+1)) nanoseconds
+#ifdef RBN_ATTACK_CACHE
+    uint64_t attack_hits; // Notes started from a recorded attack
+    uint64_t attack_misses; // Notes that recorded theirs
+#endif
+  } rbn_stats;
+
+  // Relaxed atomic accesses to 64-bit counters, also usable for counters outside of robin
+#ifndef RBN_STATS_STORE
+#if defined(__GNUC__) || defined(__clang__)
+#define RBN_STATS_STORE(dst, value) __atomic_store_n(&(dst), (value), __ATOMIC_RELAXED)
+#define RBN_STATS_LOAD(src) __atomic_load_n(&(src), __ATOMIC_RELAXED)
+#else // Aligned 64-bit accesses are atomic on the 64-bit targets MSVC supports
+#define RBN_STATS_STORE(dst, value) (*(volatile uint64_t*)&(dst) = (value))
+#define RBN_STATS_LOAD(src) (*(volatile const uint64_t*)&(src))
+#endif
+#endif
+
+  // There is a single writer so read-modify-write does not need to be atomic
+#define RBN_STATS_ADD(dst, value) RBN_STATS_STORE(dst, (dst) + (value))
+#endif
+
   typedef struct rbn_output_config {
     void* left_buffer;
     void* right_buffer;
@@ -180,19 +264,57 @@ extern "C" {
     rbn_sample_format sample_format;
   } rbn_output_config;
 
+  // Kept to 8 bytes so that walking an event list is a linear scan over small records
+  typedef struct rbn_event {
+    uint32_t sample; // Relative to the first sample rendered by rbn_render_sequence
+    rbn_msg msg;
+  } rbn_event;
+
+  typedef struct rbn_sequence_output {
+    rbn_output_config buffer; // Advanced as it is filled, its sample count being the room left
+    uint64_t sample_count; // Length of the sequence, events past it are not sent
+    // Optional, called with the number of samples written whenever the buffer is full and at the end.
+    // It can point the buffer to more room, otherwise rendering stops once the buffer is full
+    void (*sink)(void* user_data, rbn_output_config* buffer, uint64_t sample_count);
+    void* user_data;
+#ifdef RBN_STEMS
+    rbn_output_config* stems; // Optional, see rbn_render_stems, the sink has to advance them too
+#endif
+  } rbn_sequence_output;
+
+  // Instances share no mutable state, so each can be used from its own thread without locking.
+  // Overrides of RBN_SIN, RBN_COS, RBN_POW and RBN_RAND have to keep that true
   typedef struct rbn_instance {
     rbn_config config;
     uint64_t sample_index;
     uint64_t output_index;
     uint64_t rendered_samples;
+    uint64_t silent_index; // No voice sounds from this sample on, or later when notes were stopped early
+    int silent_buffer; // sample_buffer only holds zeros
 
     float dynamic_range;
+    uint32_t random_state; // Restarts from the seed on reset, so renders are reproducible
 
     rbn_channel channels[RBN_CHAN_COUNT];
     rbn_program programs[RBN_PROGRAM_COUNT];
     rbn_voice voices[RBN_VOICE_COUNT];
+    rbn_parser parser;
+#ifdef RBN_KEYMAP_CHANNEL
+    rbn_oneshot oneshots[RBN_PROGRAM_COUNT - RBN_KEYMAP_OFFSET]; // Indexed by key
+#endif
+#ifdef RBN_ATTACK_CACHE
+    rbn_attack_cache attack_cache;
+#endif
 
     float sample_buffer[RBN_BLOCK_SAMPLES * 2];
+#ifdef RBN_STEMS
+    float stem_buffer[RBN_CHAN_COUNT][RBN_BLOCK_SAMPLES * 2];
+    int stem_block; // stem_buffer holds the stems of the block in sample_buffer
+#endif
+
+#ifdef RBN_STATS
+    rbn_stats stats;
+#endif
 
     // Cached
     float inv_sample_rate;
@@ -204,20 +326,63 @@ extern "C" {
   RBNDEF rbn_result rbn_refresh(rbn_instance* inst);
   RBNDEF rbn_result rbn_reset(rbn_instance* inst);
   RBNDEF rbn_result rbn_render(rbn_instance* inst, rbn_output_config* output_config);
+  // Nonzero when rbn_render would only write zeros until a note is played. Hosts can skip processing
+  // that output, but still have to render it to keep time
+  RBNDEF int rbn_is_silent(const rbn_instance* inst);
+  RBNDEF rbn_result rbn_render_sequence(rbn_instance* inst, const rbn_event* events, size_t event_count, rbn_sequence_output* output);
+#ifdef RBN_STEMS
+  // Renders like rbn_render while writing each channel to its own output in the same pass, the mix being
+  // their sum and normalized together. stem_configs holds RBN_CHAN_COUNT outputs with as much room as
+  // output_config, those without a left buffer are skipped. The rest of a block started by rbn_render
+  // is written as silence to the stems. A stem can exceed the range of the mix when channels cancel
+  // each other out, in which case s16 stems are clipped and no longer add up to the mix exactly
+  RBNDEF rbn_result rbn_render_stems(rbn_instance* inst, rbn_output_config* output_config, rbn_output_config* stem_configs);
+#endif
 
   RBNDEF rbn_result rbn_send_msg(rbn_instance* inst, rbn_msg msg);
+  RBNDEF rbn_result rbn_send_bytes(rbn_instance* inst, const uint8_t* bytes, size_t size);
+  RBNDEF int rbn_parse_byte(rbn_parser* parser, uint8_t byte, rbn_msg* msg);
   RBNDEF rbn_result rbn_play_note(rbn_instance* inst, uint8_t channel, uint8_t key, uint8_t velocity);
   RBNDEF rbn_result rbn_stop_note(rbn_instance* inst, uint8_t channel, uint8_t key);
   RBNDEF rbn_result rbn_stop_all_notes(rbn_instance* inst);
   RBNDEF rbn_result rbn_set_program(rbn_instance* inst, uint8_t channel, uint8_t program);
   RBNDEF rbn_result rbn_set_pitch_bend(rbn_instance* inst, uint8_t channel, float value);
 
+#ifdef RBN_STATS
+  RBNDEF rbn_result rbn_get_stats(const rbn_instance* inst, rbn_stats* stats);
+#endif
+
+#ifdef RBN_KEYMAP_CHANNEL
+  // Keymapped notes play a fixed waveform scaled by velocity and channel volume, so each program can be
+  // rendered once into caller memory and played back instead of synthesized. Programs with noise get
+  // noise_variations takes, picked at random for each note, or are still synthesized if it is zero.
+  // Notes started with pitch bend are synthesized, and note offs do not cut one-shots short.
+  // The memory is only read afterwards, so instances copied from this one can share it.
+  // rbn_refresh goes back to synthesizing, as edited programs would not match their one-shots anymore
+  RBNDEF size_t rbn_oneshot_size(const rbn_instance* inst, uint32_t noise_variations); // In bytes
+  RBNDEF rbn_result rbn_oneshot_init(rbn_instance* inst, void* memory, size_t size, uint32_t noise_variations);
+#endif
+
+#ifdef RBN_ATTACK_CACHE
+  // Without noise, the attack of a tonal note only depends on its program and pitch, velocity and channel
+  // volume scaling its output. Notes record up to max_time seconds of it into slots of caller memory,
+  // and later notes of the same program and pitch play it back, handing off to synthesis from the recorded
+  // state once it runs out, they are released or pitch bent. The least recently started slot is reused
+  // unless a voice still plays from it. Slots are written while rendering, so unlike one-shots the
+  // memory cannot be shared between instances. A null memory disables the cache, and rbn_refresh
+  // forgets what was recorded
+  RBNDEF size_t rbn_attack_cache_slot_size(const rbn_instance* inst, float max_time); // In bytes
+  RBNDEF rbn_result rbn_attack_cache_init(rbn_instance* inst, void* memory, size_t size, float max_time);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
 #endif // ROBIN_H
 
-#ifdef RBN_IMPLEMENTATION
+// Guarded so that headers including robin.h can follow the implementation
+#if defined(RBN_IMPLEMENTATION) && !defined(RBN_IMPLEMENTED)
+#define RBN_IMPLEMENTED
 
 #ifdef __cplusplus
 extern "C" {
@@ -245,8 +410,16 @@ extern "C" {
 #endif
 
 #ifndef RBN_RAND
-#include <stdlib.h>
-#define RBN_RAND() (((float)rand() / (RAND_MAX / 2)) - 1.f)
+  // Xorshift, returns a value in [-1, 1)
+  static float rbn_random(rbn_instance* inst) {
+    uint32_t x = inst->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    inst->random_state = x;
+    return (float)(x >> 8) * (2.f / 16777216.f) - 1.f;
+  }
+#define RBN_RAND(inst) rbn_random(inst)
 #endif
 
 #ifndef RBN_MEMCPY
@@ -257,6 +430,43 @@ extern "C" {
 #ifndef RBN_MEMSET
 #include <string.h>
 #define RBN_MEMSET memset
+#endif
+
+#ifdef RBN_STATS
+#ifndef RBN_STATS_TIME
+#include <time.h>
+#if defined(__unix__) || defined(__APPLE__)
+  static uint64_t rbn_stats_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+#else
+  static uint64_t rbn_stats_time() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+#endif
+#define RBN_STATS_TIME() rbn_stats_time()
+#endif
+#endif
+
+// Tracing hooks, they expand to nothing unless defined before the implementation
+#ifndef RBN_TRACE_BLOCK_BEGIN
+#define RBN_TRACE_BLOCK_BEGIN(inst)
+#endif
+#ifndef RBN_TRACE_BLOCK_END
+#define RBN_TRACE_BLOCK_END(inst)
+#endif
+#ifndef RBN_TRACE_VOICE_BEGIN
+#define RBN_TRACE_VOICE_BEGIN(inst, voice)
+#endif
+#ifndef RBN_TRACE_VOICE_END
+#define RBN_TRACE_VOICE_END(inst, voice)
+#endif
+#ifndef RBN_TRACE_MSG
+#define RBN_TRACE_MSG(inst, msg)
 #endif
 
   static float rbn_max(float a, float b) {
@@ -348,7 +558,7 @@ extern "C" {
         }
 
         const float noisef = program->operators[j].noise;
-        const float noise = RBN_RAND();
+        const float noise = RBN_RAND(inst);
         values[j] = (RBN_SIN(phase * RBN_TAU) * (1.f - noisef) + noise * noisef) * volumes[j];
         volumes[j] += volume_rates[j];
       }
@@ -377,16 +587,227 @@ extern "C" {
     return rbn_success;
   }
 
-  static rbn_result rbn_render_block(rbn_instance* inst, float* samples) {
+#if defined(RBN_KEYMAP_CHANNEL) || defined(RBN_ATTACK_CACHE)
+  // Adds a block rendered at full velocity in a left-only channel
+  static void rbn_play_mono_block(rbn_instance* inst, const rbn_voice* voice, const rbn_channel* channel, const float* mono, float* samples) {
+    const float left = voice->velocity * channel->volume[0];
+    const float right = voice->velocity * channel->volume[1];
+    for(uintptr_t i = 0; i < RBN_BLOCK_SAMPLES; i++) {
+      samples[i * 2 + 0] += mono[i] * left;
+      samples[i * 2 + 1] += mono[i] * right;
+    }
+    inst->rendered_samples += RBN_BLOCK_SAMPLES;
+  }
+
+  static int rbn_program_has_noise(const rbn_program* program) {
+    for(uintptr_t i = 0; i < RBN_OPERATOR_COUNT; i++) {
+      if(RBN_OPERATOR_USED(program, i) && program->operators[i].noise > 0.f) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+#endif
+
+#ifdef RBN_ATTACK_CACHE
+#define RBN_ATTACK_STATE_FLOATS (4 * RBN_OPERATOR_COUNT)
+
+  static rbn_attack_slot* rbn_attack_slot_at(const rbn_attack_cache* cache, uintptr_t index) {
+    return (rbn_attack_slot*)(cache->memory + index * cache->slot_size);
+  }
+
+  static float* rbn_attack_state(rbn_attack_slot* slot, uint32_t block) {
+    return (float*)(slot + 1) + block * RBN_ATTACK_STATE_FLOATS;
+  }
+
+  static float* rbn_attack_samples(const rbn_attack_cache* cache, rbn_attack_slot* slot, uint32_t block) {
+    return (float*)(slot + 1) + (cache->slot_blocks + 1) * RBN_ATTACK_STATE_FLOATS + block * RBN_BLOCK_SAMPLES;
+  }
+
+  static void rbn_attack_save_state(float* state, const rbn_voice* voice) {
+    RBN_MEMCPY(state + 0 * RBN_OPERATOR_COUNT, voice->phases, sizeof(voice->phases));
+    RBN_MEMCPY(state + 1 * RBN_OPERATOR_COUNT, voice->values, sizeof(voice->values));
+    RBN_MEMCPY(state + 2 * RBN_OPERATOR_COUNT, voice->volumes, sizeof(voice->volumes));
+    RBN_MEMCPY(state + 3 * RBN_OPERATOR_COUNT, voice->pitches, sizeof(voice->pitches));
+  }
+
+  static void rbn_attack_load_state(rbn_voice* voice, const float* state) {
+    RBN_MEMCPY(voice->phases, state + 0 * RBN_OPERATOR_COUNT, sizeof(voice->phases));
+    RBN_MEMCPY(voice->values, state + 1 * RBN_OPERATOR_COUNT, sizeof(voice->values));
+    RBN_MEMCPY(voice->volumes, state + 2 * RBN_OPERATOR_COUNT, sizeof(voice->volumes));
+    RBN_MEMCPY(voice->pitches, state + 3 * RBN_OPERATOR_COUNT, sizeof(voice->pitches));
+  }
+
+  // Plays back or records a block of a voice's attack, returns zero when it has to be synthesized instead
+  static int rbn_attack_block(rbn_instance* inst, rbn_voice* voice, rbn_channel* channel, float* samples) {
+    const rbn_attack_cache* cache = &inst->attack_cache;
+    rbn_attack_slot* slot = voice->attack;
+    const uint32_t block = (uint32_t)((inst->sample_index - voice->press_index) / RBN_BLOCK_SAMPLES);
+    const int diverged = voice->release_index <= inst->sample_index || voice->base_freq_rate != slot->base_freq_rate;
+
+    if(voice->recording) {
+      if(diverged || block >= slot->attack_blocks) {
+        voice->attack = NULL;
+        return 0;
+      }
+      rbn_channel mono_channel = {.volume = {1.f, 0.f}};
+      float mono_samples[RBN_BLOCK_SAMPLES * 2] = {0};
+      const float velocity = voice->velocity;
+      voice->velocity = 1.f;
+      rbn_render_voice_block(inst, voice, &mono_channel, mono_samples);
+      voice->velocity = velocity;
+
+      float* mono = rbn_attack_samples(cache, slot, block);
+      for(uintptr_t i = 0; i < RBN_BLOCK_SAMPLES; i++) {
+        mono[i] = mono_samples[i * 2];
+      }
+      rbn_attack_save_state(rbn_attack_state(slot, block + 1), voice);
+      slot->block_count = block + 1;
+      rbn_play_mono_block(inst, voice, channel, mono, samples);
+      inst->rendered_samples -= RBN_BLOCK_SAMPLES; // Already counted by the voice block
+      return 1;
+    }
+
+    if(diverged || block >= slot->block_count) {
+      // The voice goes on as if it had been synthesized all along
+      rbn_attack_load_state(voice, rbn_attack_state(slot, block));
+      voice->attack = NULL;
+      return 0;
+    }
+    rbn_play_mono_block(inst, voice, channel, rbn_attack_samples(cache, slot, block), samples);
+    return 1;
+  }
+
+  static int rbn_attack_slot_playing(const rbn_instance* inst, const rbn_attack_slot* slot) {
+    for(uintptr_t i = 0; i < RBN_VOICE_COUNT; i++) {
+      const rbn_voice* voice = inst->voices + i;
+      if(voice->attack == slot && voice->inactive_index > inst->sample_index) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  static void rbn_attack_start(rbn_instance* inst, rbn_voice* voice) {
+    const rbn_attack_cache* cache = &inst->attack_cache;
+    const rbn_program* program = voice->program;
+    if(!cache->memory || program->sustain_samples == 0 || rbn_program_has_noise(program)) {
+      return;
+    }
+
+    const uint16_t program_index = (uint16_t)(program - inst->programs);
+    rbn_attack_slot* lru = NULL;
+    for(uintptr_t i = 0; i < cache->slot_count; i++) {
+      rbn_attack_slot* slot = rbn_attack_slot_at(cache, i);
+      if(slot->program == program_index && slot->base_freq_rate == voice->base_freq_rate) {
+        slot->last_use = inst->sample_index + 1;
+        voice->attack = slot;
+#ifdef RBN_STATS
+        RBN_STATS_ADD(inst->stats.attack_hits, 1);
+#endif
+        return;
+      }
+      if(!lru || slot->last_use < lru->last_use) {
+        lru = slot;
+      }
+    }
+
+    // Rather than looking further, notes are synthesized as usual in the rare case it is still playing
+    if(rbn_attack_slot_playing(inst, lru)) {
+      return;
+    }
+    const uint64_t attack_blocks = (program->sustain_samples + RBN_BLOCK_SAMPLES - 1) / RBN_BLOCK_SAMPLES;
+    lru->last_use = inst->sample_index + 1;
+    lru->base_freq_rate = voice->base_freq_rate;
+    lru->block_count = 0;
+    lru->attack_blocks = attack_blocks < cache->slot_blocks ? (uint32_t)attack_blocks : cache->slot_blocks;
+    lru->program = program_index;
+    rbn_attack_save_state(rbn_attack_state(lru, 0), voice);
+    voice->attack = lru;
+    voice->recording = 1;
+#ifdef RBN_STATS
+    RBN_STATS_ADD(inst->stats.attack_misses, 1);
+#endif
+  }
+
+  static void rbn_attack_forget(rbn_instance* inst) {
+    const rbn_attack_cache* cache = &inst->attack_cache;
+    for(uintptr_t i = 0; i < cache->slot_count; i++) {
+      rbn_attack_slot* slot = rbn_attack_slot_at(cache, i);
+      slot->last_use = 0;
+      slot->program = RBN_PROGRAM_COUNT;
+    }
+  }
+#endif
+
+  static void rbn_render_voice(rbn_instance* inst, rbn_voice* voice, rbn_channel* channel, float* samples) {
+#ifdef RBN_KEYMAP_CHANNEL
+    if(voice->oneshot) {
+      rbn_play_mono_block(inst, voice, channel, voice->oneshot + (inst->sample_index - voice->press_index), samples);
+      return;
+    }
+#endif
+#ifdef RBN_ATTACK_CACHE
+    if(voice->attack && rbn_attack_block(inst, voice, channel, samples)) {
+      return;
+    }
+#endif
+    rbn_render_voice_block(inst, voice, channel, samples);
+  }
+
+  // Voices go to the stem of their channel instead when stem_samples is not null
+  static rbn_result rbn_render_block(rbn_instance* inst, float* samples, float* stem_samples) {
+#ifdef RBN_STATS
+    uint64_t active_voices = 0;
+#endif
+    uint64_t silent_index = 0;
     for(uintptr_t v = 0; v < RBN_VOICE_COUNT; v++) {
       rbn_voice* voice = inst->voices + v;
       if(voice->inactive_index > inst->sample_index) {
-        rbn_render_voice_block(inst, voice, inst->channels + voice->channel, samples);
+        if(voice->inactive_index > silent_index) {
+          silent_index = voice->inactive_index;
+        }
+        float* voice_samples = stem_samples ? stem_samples + voice->channel * (RBN_BLOCK_SAMPLES * 2) : samples;
+        RBN_TRACE_VOICE_BEGIN(inst, voice);
+        rbn_render_voice(inst, voice, inst->channels + voice->channel, voice_samples);
+        RBN_TRACE_VOICE_END(inst, voice);
+#ifdef RBN_STATS
+        active_voices++;
+#endif
+      }
+    }
+    if(stem_samples) {
+      for(uintptr_t c = 0; c < RBN_CHAN_COUNT; c++) {
+        for(uintptr_t i = 0; i < RBN_BLOCK_SAMPLES * 2; i++) {
+          samples[i] += stem_samples[c * (RBN_BLOCK_SAMPLES * 2) + i];
+        }
       }
     }
+    inst->silent_index = silent_index;
+#ifdef RBN_STATS
+    RBN_STATS_STORE(inst->stats.active_voices, active_voices);
+    RBN_STATS_ADD(inst->stats.voice_blocks, active_voices);
+    if(active_voices > inst->stats.peak_voices) {
+      RBN_STATS_STORE(inst->stats.peak_voices, active_voices);
+    }
+#endif
     return rbn_success;
   }
 
+#ifdef RBN_STATS
+  static void rbn_stats_add_block_time(rbn_instance* inst, uint64_t time) {
+    uintptr_t bucket = 0;
+    while(bucket < RBN_STATS_HISTOGRAM_BUCKETS - 1 && (time >> (bucket + 1)) != 0) {
+      bucket++;
+    }
+    RBN_STATS_ADD(inst->stats.block_time_histogram[bucket], 1);
+    RBN_STATS_ADD(inst->stats.blocks, 1);
+    if(time > inst->stats.max_block_time) {
+      RBN_STATS_STORE(inst->stats.max_block_time, time);
+    }
+  }
+#endif
+
   static float rbn_compute_dynamic_range(rbn_instance* inst, float sample) {
     const float range = fabsf(sample) * 1.01f;
     if(range > inst->dynamic_range) {
@@ -395,6 +816,26 @@ extern "C" {
     return sample / inst->dynamic_range;
   }
 
+  // Silence leaves the dynamic range as it is, so it is written as is
+  static void rbn_output_silence(rbn_output_config* output_config, uint64_t sample_count) {
+    const size_t size = output_config->sample_format == rbn_s16 ? sizeof(int16_t) : sizeof(float);
+    uint8_t* left = (uint8_t*)output_config->left_buffer;
+    uint8_t* right = (uint8_t*)output_config->right_buffer;
+    if(output_config->stride == 2 && right == left + size) {
+      RBN_MEMSET(left, 0, sample_count * 2 * size); // Interleaved
+    } else if(output_config->stride == 1) {
+      RBN_MEMSET(left, 0, sample_count * size); // Planar
+      RBN_MEMSET(right, 0, sample_count * size);
+    } else {
+      for(uintptr_t i = 0; i < sample_count; i++) {
+        RBN_MEMSET(left + i * output_config->stride * size, 0, size);
+        RBN_MEMSET(right + i * output_config->stride * size, 0, size);
+      }
+    }
+    output_config->left_buffer = left + sample_count * output_config->stride * size;
+    output_config->right_buffer = right + sample_count * output_config->stride * size;
+  }
+
   static uint64_t rbn_output_samples(rbn_instance* inst, rbn_output_config* output_config) {
     uint64_t output_sample_count = inst->sample_index - inst->output_index;
     if(output_sample_count == 0) {
@@ -403,6 +844,12 @@ extern "C" {
     if(output_sample_count > output_config->sample_count) {
       output_sample_count = output_config->sample_count;
     }
+    if(inst->silent_buffer) {
+      rbn_output_silence(output_config, output_sample_count);
+      inst->output_index += output_sample_count;
+      output_config->sample_count -= output_sample_count;
+      return output_config->sample_count;
+    }
     float* bsamples = inst->sample_buffer + (inst->output_index % RBN_BLOCK_SAMPLES) * 2;
     float* lf32samples = (float*)output_config->left_buffer;
     float* rf32samples = (float*)output_config->right_buffer;
@@ -429,12 +876,70 @@ extern "C" {
         output_config->left_buffer = li16samples;
         output_config->right_buffer = ri16samples;
         break;
+      case rbn_f32_raw:
+        for(uintptr_t i = 0; i < output_sample_count; i++) {
+          *lf32samples = *bsamples++;
+          *rf32samples = *bsamples++;
+          lf32samples += output_config->stride;
+          rf32samples += output_config->stride;
+        }
+        output_config->left_buffer = lf32samples;
+        output_config->right_buffer = rf32samples;
+        break;
     }
     inst->output_index += output_sample_count;
     output_config->sample_count -= output_sample_count;
     return output_config->sample_count;
   }
 
+#ifdef RBN_STEMS
+  static int16_t rbn_stem_s16(float sample) {
+    const float scaled = sample * 0x8000;
+    return (int16_t)(scaled > 0x7fff ? 0x7fff : scaled < -0x8000 ? -0x8000 : scaled);
+  }
+
+  // Stems are scaled by the ranges of the mix sample by sample, so that they still add up to it
+  static void rbn_output_stem_samples(const float* ranges, const float* bsamples, uint64_t sample_count, rbn_output_config* output_config) {
+    float* lf32samples = (float*)output_config->left_buffer;
+    float* rf32samples = (float*)output_config->right_buffer;
+    int16_t* li16samples = (int16_t*)output_config->left_buffer;
+    int16_t* ri16samples = (int16_t*)output_config->right_buffer;
+    switch(output_config->sample_format) {
+      case rbn_f32:
+        for(uintptr_t i = 0; i < sample_count; i++) {
+          *lf32samples = *bsamples++ / *ranges++;
+          *rf32samples = *bsamples++ / *ranges++;
+          lf32samples += output_config->stride;
+          rf32samples += output_config->stride;
+        }
+        output_config->left_buffer = lf32samples;
+        output_config->right_buffer = rf32samples;
+        break;
+      case rbn_s16:
+        for(uintptr_t i = 0; i < sample_count; i++) {
+          *li16samples = rbn_stem_s16(*bsamples++ / *ranges++);
+          *ri16samples = rbn_stem_s16(*bsamples++ / *ranges++);
+          li16samples += output_config->stride;
+          ri16samples += output_config->stride;
+        }
+        output_config->left_buffer = li16samples;
+        output_config->right_buffer = ri16samples;
+        break;
+      case rbn_f32_raw:
+        for(uintptr_t i = 0; i < sample_count; i++) {
+          *lf32samples = *bsamples++;
+          *rf32samples = *bsamples++;
+          lf32samples += output_config->stride;
+          rf32samples += output_config->stride;
+        }
+        output_config->left_buffer = lf32samples;
+        output_config->right_buffer = rf32samples;
+        break;
+    }
+    output_config->sample_count -= sample_count;
+  }
+#endif
+
   rbn_result rbn_init(rbn_instance* inst, const rbn_config* config) {
     RBN_MEMSET(inst, 0, sizeof(rbn_instance));
     RBN_MEMCPY(&inst->config, config, sizeof(*config));
@@ -460,6 +965,12 @@ extern "C" {
   }
 
   rbn_result rbn_refresh(rbn_instance* inst) {
+#ifdef RBN_KEYMAP_CHANNEL
+    RBN_MEMSET(inst->oneshots, 0, sizeof(inst->oneshots));
+#endif
+#ifdef RBN_ATTACK_CACHE
+    rbn_attack_forget(inst);
+#endif
     for(uintptr_t i = 0; i < RBN_PROGRAM_COUNT; i++) {
       rbn_program* program = inst->programs + i;
       program->sustain_samples = 0;
@@ -514,26 +1025,197 @@ extern "C" {
     inst->sample_index = 0;
     inst->output_index = 0;
     inst->rendered_samples = 0;
+    inst->silent_index = 0;
+    inst->silent_buffer = 0;
     inst->dynamic_range = 1.f;
+    inst->random_state = inst->config.seed ? inst->config.seed : 0x9e3779b9;
+    RBN_MEMSET(&inst->parser, 0, sizeof(inst->parser));
+#ifdef RBN_ATTACK_CACHE
+    // Recorded attacks stay valid, only their ages are relative to the clock
+    for(uintptr_t i = 0; i < inst->attack_cache.slot_count; i++) {
+      rbn_attack_slot_at(&inst->attack_cache, i)->last_use = 0;
+    }
+#endif
+
+#ifdef RBN_STATS
+    rbn_stats* stats = &inst->stats;
+    RBN_STATS_STORE(stats->active_voices, 0);
+    RBN_STATS_STORE(stats->peak_voices, 0);
+    RBN_STATS_STORE(stats->voice_allocation_failures, 0);
+    for(uintptr_t i = 0; i < sizeof(stats->messages) / sizeof(*stats->messages); i++) {
+      RBN_STATS_STORE(stats->messages[i], 0);
+    }
+    RBN_STATS_STORE(stats->voice_blocks, 0);
+    RBN_STATS_STORE(stats->blocks, 0);
+    RBN_STATS_STORE(stats->idle_blocks, 0);
+    RBN_STATS_STORE(stats->max_block_time, 0);
+    for(uintptr_t i = 0; i < RBN_STATS_HISTOGRAM_BUCKETS; i++) {
+      RBN_STATS_STORE(stats->block_time_histogram[i], 0);
+    }
+#ifdef RBN_ATTACK_CACHE
+    RBN_STATS_STORE(stats->attack_hits, 0);
+    RBN_STATS_STORE(stats->attack_misses, 0);
+#endif
+#endif
 
     return rbn_success;
   }
 
+  static rbn_result rbn_render_next_block(rbn_instance* inst, float* stem_samples) {
+#ifdef RBN_STEMS
+    inst->stem_block = stem_samples != NULL;
+#endif
+    // Without any voice there is nothing to walk, and the buffer is only cleared once
+    if(inst->sample_index >= inst->silent_index) {
+      if(!inst->silent_buffer) {
+        RBN_MEMSET(inst->sample_buffer, 0, sizeof(inst->sample_buffer));
+        inst->silent_buffer = 1;
+      }
+#ifdef RBN_STATS
+      RBN_STATS_STORE(inst->stats.active_voices, 0);
+      RBN_STATS_ADD(inst->stats.idle_blocks, 1);
+#endif
+      inst->sample_index += RBN_BLOCK_SAMPLES;
+      return rbn_success;
+    }
+
+    memset(inst->sample_buffer, 0, sizeof(inst->sample_buffer));
+    inst->silent_buffer = 0;
+#ifdef RBN_STATS
+    const uint64_t start_time = RBN_STATS_TIME();
+#endif
+    RBN_TRACE_BLOCK_BEGIN(inst);
+    rbn_result result = rbn_render_block(inst, inst->sample_buffer, stem_samples);
+    RBN_TRACE_BLOCK_END(inst);
+    if(result != rbn_success) {
+      return result;
+    }
+#ifdef RBN_STATS
+    const uint64_t end_time = RBN_STATS_TIME();
+    rbn_stats_add_block_time(inst, end_time > start_time ? end_time - start_time : 0);
+#endif
+
+    inst->sample_index += RBN_BLOCK_SAMPLES;
+    return rbn_success;
+  }
+
   rbn_result rbn_render(rbn_instance* inst, rbn_output_config* output_config) {
     while(rbn_output_samples(inst, output_config) > 0) {
-      memset(inst->sample_buffer, 0, sizeof(inst->sample_buffer));
-      rbn_result result = rbn_render_block(inst, inst->sample_buffer);
+      rbn_result result = rbn_render_next_block(inst, NULL);
       if(result != rbn_success) {
         return result;
       }
+    }
+    return rbn_success;
+  }
 
-      inst->sample_index += RBN_BLOCK_SAMPLES;
+  int rbn_is_silent(const rbn_instance* inst) {
+    const int buffered_silence = inst->silent_buffer || inst->output_index == inst->sample_index;
+    return buffered_silence && inst->sample_index >= inst->silent_index;
+  }
+
+#ifdef RBN_STEMS
+  rbn_result rbn_render_stems(rbn_instance* inst, rbn_output_config* output_config, rbn_output_config* stem_configs) {
+    float ranges[RBN_BLOCK_SAMPLES * 2];
+    if(!inst->stem_block) {
+      memset(inst->stem_buffer, 0, sizeof(inst->stem_buffer));
+      inst->stem_block = 1;
+    }
+    while(1) {
+      // Follows the range of the mix as rbn_output_samples will widen it
+      const uintptr_t offset = (inst->output_index % RBN_BLOCK_SAMPLES) * 2;
+      uint64_t sample_count = inst->sample_index - inst->output_index;
+      if(sample_count > output_config->sample_count) {
+        sample_count = output_config->sample_count;
+      }
+      float range = inst->dynamic_range;
+      for(uintptr_t i = 0; i < sample_count * 2; i++) {
+        range = rbn_max(range, fabsf(inst->sample_buffer[offset + i]) * 1.01f);
+        ranges[i] = range;
+      }
+
+      const uint64_t remaining = rbn_output_samples(inst, output_config);
+      for(uintptr_t c = 0; c < RBN_CHAN_COUNT; c++) {
+        if(stem_configs[c].left_buffer) {
+          rbn_output_stem_samples(ranges, inst->stem_buffer[c] + offset, sample_count, stem_configs + c);
+        }
+      }
+      if(remaining == 0) {
+        break;
+      }
+
+      memset(inst->stem_buffer, 0, sizeof(inst->stem_buffer));
+      rbn_result result = rbn_render_next_block(inst, inst->stem_buffer[0]);
+      if(result != rbn_success) {
+        return result;
+      }
+    }
+    return rbn_success;
+  }
+#endif
+
+  rbn_result rbn_render_sequence(rbn_instance* inst, const rbn_event* events, size_t event_count, rbn_sequence_output* output) {
+    rbn_output_config* buffer = &output->buffer;
+    if(!output->sink && buffer->sample_count < output->sample_count) {
+      return rbn_buffer_too_small;
+    }
+
+    uint64_t position = 0;
+    uint64_t written = 0; // Since the last call to the sink
+    size_t event_index = 0;
+    while(1) {
+      for(; event_index < event_count && events[event_index].sample <= position; event_index++) {
+        rbn_send_msg(inst, events[event_index].msg);
+      }
+      if(position == output->sample_count) {
+        break;
+      }
+
+      // Renders up to the next event in one go, as far as the buffer allows
+      uint64_t sample_count = output->sample_count - position;
+      if(event_index < event_count && events[event_index].sample - position < sample_count) {
+        sample_count = events[event_index].sample - position;
+      }
+      const uint64_t room = buffer->sample_count;
+      if(sample_count > room) {
+        sample_count = room;
+      }
+      if(sample_count == 0) {
+        return rbn_buffer_too_small;
+      }
+
+      buffer->sample_count = sample_count;
+#ifdef RBN_STEMS
+      const rbn_result result = output->stems ? rbn_render_stems(inst, buffer, output->stems) : rbn_render(inst, buffer);
+#else
+      const rbn_result result = rbn_render(inst, buffer);
+#endif
+      buffer->sample_count = room - sample_count;
+      if(result != rbn_success) {
+        return result;
+      }
+      position += sample_count;
+      written += sample_count;
+
+      if(buffer->sample_count == 0 && output->sink) {
+        output->sink(output->user_data, buffer, written);
+        written = 0;
+      }
+    }
+
+    if(written > 0 && output->sink) {
+      output->sink(output->user_data, buffer, written);
     }
     return rbn_success;
   }
 
   rbn_result rbn_send_msg(rbn_instance* inst, rbn_msg msg) {
+    RBN_TRACE_MSG(inst, msg);
     rbn_channel* channel = inst->channels + msg.channel;
+#ifdef RBN_STATS
+    const uintptr_t stats_index = msg.type >= rbn_note_off ? (msg.type >> 4) - 8 : 7;
+    RBN_STATS_ADD(inst->stats.messages[stats_index], 1);
+#endif
     switch(msg.type) {
       case rbn_end_of_track:
       case rbn_set_tempo: break; // Ignore
@@ -567,7 +1249,69 @@ extern "C" {
     return rbn_success;
   }
 
+  static uint8_t rbn_data_length(uint8_t status) {
+    switch(status & 0xf0) {
+      case rbn_program_change:
+      case rbn_channel_pressure:
+        return 1;
+      case 0xf0: // System common messages, only their length matters as they are skipped
+        return status == 0xf1 || status == 0xf3 ? 1 : status == 0xf2 ? 2 : 0;
+      default:
+        return 2;
+    }
+  }
+
+  int rbn_parse_byte(rbn_parser* parser, uint8_t byte, rbn_msg* msg) {
+    if(byte >= 0xf8) { // Real-time messages can appear anywhere, even inside other messages
+      return 0;
+    } else if(byte & 0x80) {
+      // Any other status cancels running status, SysEx payloads are ignored until the next status
+      parser->status = byte < 0xf0 || byte == 0xf0 || rbn_data_length(byte) > 0 ? byte : 0;
+      parser->data_count = 0;
+      return 0;
+    } else if(parser->status == 0 || parser->status == 0xf0) {
+      return 0;
+    }
+
+    parser->data[parser->data_count++] = byte;
+    const uint8_t length = rbn_data_length(parser->status);
+    if(parser->data_count < length) {
+      return 0;
+    }
+    parser->data_count = 0;
+    if(parser->status >= 0xf0) {
+      parser->status = 0;
+      return 0;
+    }
+    msg->channel = parser->status & 0x0f;
+    msg->type = parser->status & 0xf0;
+    msg->u8[2] = parser->data[0];
+    msg->u8[3] = length > 1 ? parser->data[1] : 0;
+    return 1;
+  }
+
+  rbn_result rbn_send_bytes(rbn_instance* inst, const uint8_t* bytes, size_t size) {
+    rbn_result result = rbn_success;
+    rbn_msg msg;
+    for(size_t i = 0; i < size; i++) {
+      if(rbn_parse_byte(&inst->parser, bytes[i], &msg)) {
+        // Keep dispatching the rest of the buffer, only reporting the first failure
+        const rbn_result msg_result = rbn_send_msg(inst, msg);
+        if(result == rbn_success) {
+          result = msg_result;
+        }
+      }
+    }
+    return result;
+  }
+
   rbn_result rbn_play_note(rbn_instance* inst, uint8_t channel, uint8_t key, uint8_t velocity) {
+#ifdef RBN_KEYMAP_CHANNEL
+    // Keys past the last keymapped program have no sound
+    if(channel == RBN_KEYMAP_CHANNEL && RBN_KEYMAP_OFFSET + key >= RBN_PROGRAM_COUNT) {
+      return rbn_success;
+    }
+#endif
     for(uintptr_t i = 0; i < RBN_VOICE_COUNT; i++) {
       rbn_voice* voice = inst->voices + i;
       const int active = voice->inactive_index > inst->sample_index;
@@ -587,12 +1331,32 @@ extern "C" {
           // Keymapped notes are instantly off
           voice->release_index = voice->press_index + voice->program->sustain_samples;
           voice->inactive_index = voice->release_index + voice->program->release_samples;
+
+          const rbn_oneshot* oneshot = inst->oneshots + key;
+          if(oneshot->samples && inst->channels[channel].pitch_bend == 0.f) {
+            uint32_t variation = (uint32_t)((RBN_RAND(inst) + 1.f) * 0.5f * oneshot->variation_count);
+            if(variation >= oneshot->variation_count) {
+              variation = oneshot->variation_count - 1;
+            }
+            voice->oneshot = oneshot->samples + (size_t)variation * oneshot->sample_count;
+          }
         }
 #endif
         rbn_voice_compute_base_freq_rate(inst, voice);
+        if(voice->inactive_index > inst->silent_index) {
+          inst->silent_index = voice->inactive_index;
+        }
+#ifdef RBN_ATTACK_CACHE
+        if(voice->release_index == UINT64_MAX) { // Keymapped notes are left to one-shots
+          rbn_attack_start(inst, voice);
+        }
+#endif
         return rbn_success;
       }
     }
+#ifdef RBN_STATS
+    RBN_STATS_ADD(inst->stats.voice_allocation_failures, 1);
+#endif
     return rbn_out_of_voice;
   }
 
@@ -600,7 +1364,11 @@ extern "C" {
     for(uintptr_t i = 0; i < RBN_VOICE_COUNT; i++) {
       rbn_voice* voice = inst->voices + i;
       const int active = voice->inactive_index > inst->sample_index;
-      if(active && voice->channel == channel && voice->key == key) {
+      if(active && voice->channel == channel && voice->key == key
+#ifdef RBN_KEYMAP_CHANNEL
+        && !voice->oneshot
+#endif
+        ) {
         voice->release_index = inst->sample_index;
         voice->inactive_index = inst->sample_index + voice->program->release_samples;
       }
@@ -630,6 +1398,135 @@ extern "C" {
     }
     return rbn_success;
   }
+
+#ifdef RBN_KEYMAP_CHANNEL
+  static uint32_t rbn_oneshot_sample_count(const rbn_program* program) {
+    const uint64_t sample_count = program->sustain_samples + program->release_samples;
+    return (uint32_t)((sample_count + RBN_BLOCK_SAMPLES - 1) / RBN_BLOCK_SAMPLES * RBN_BLOCK_SAMPLES);
+  }
+
+  // Silent programs are left to synthesis, which costs next to nothing for them
+  static uint32_t rbn_oneshot_variation_count(const rbn_program* program, uint32_t noise_variations) {
+    if(program->operator_usage_mask == 0) {
+      return 0;
+    }
+    return rbn_program_has_noise(program) ? noise_variations : 1;
+  }
+
+  size_t rbn_oneshot_size(const rbn_instance* inst, uint32_t noise_variations) {
+    size_t size = 0;
+    for(uintptr_t i = RBN_KEYMAP_OFFSET; i < RBN_PROGRAM_COUNT; i++) {
+      const rbn_program* program = inst->programs + i;
+      size += (size_t)rbn_oneshot_sample_count(program) * rbn_oneshot_variation_count(program, noise_variations);
+    }
+    return size * sizeof(float);
+  }
+
+  rbn_result rbn_oneshot_init(rbn_instance* inst, void* memory, size_t size, uint32_t noise_variations) {
+    RBN_MEMSET(inst->oneshots, 0, sizeof(inst->oneshots));
+    if(size < rbn_oneshot_size(inst, noise_variations)) {
+      return rbn_buffer_too_small;
+    }
+
+    // Renders each program as a note of its own, from a clock starting at zero, in a left-only channel
+    const uint64_t sample_index = inst->sample_index;
+    const uint64_t rendered_samples = inst->rendered_samples;
+    const uint32_t random_state = inst->random_state;
+    rbn_channel channel = {.volume = {1.f, 0.f}};
+    float block[RBN_BLOCK_SAMPLES * 2];
+    float* samples = (float*)memory;
+    for(uintptr_t i = RBN_KEYMAP_OFFSET; i < RBN_PROGRAM_COUNT; i++) {
+      rbn_program* program = inst->programs + i;
+      rbn_oneshot* oneshot = inst->oneshots + (i - RBN_KEYMAP_OFFSET);
+      oneshot->samples = samples;
+      oneshot->sample_count = rbn_oneshot_sample_count(program);
+      oneshot->variation_count = rbn_oneshot_variation_count(program, noise_variations);
+      if(oneshot->variation_count == 0) {
+        oneshot->samples = NULL;
+        continue;
+      }
+
+      for(uint32_t v = 0; v < oneshot->variation_count; v++) {
+        rbn_voice voice = {0};
+        voice.release_index = program->sustain_samples;
+        voice.inactive_index = voice.release_index + program->release_samples;
+        voice.program = program;
+        voice.channel = RBN_KEYMAP_CHANNEL;
+        voice.key = 60;
+        voice.velocity = 1.f;
+        voice.base_freq_rate = 440.f * RBN_POW(2.f, (voice.key - 69.f) / 12.f) / inst->config.sample_rate;
+        for(inst->sample_index = 0; inst->sample_index < oneshot->sample_count; inst->sample_index += RBN_BLOCK_SAMPLES) {
+          RBN_MEMSET(block, 0, sizeof(block));
+          rbn_render_voice_block(inst, &voice, &channel, block);
+          for(uintptr_t j = 0; j < RBN_BLOCK_SAMPLES; j++) {
+            *samples++ = block[j * 2];
+          }
+        }
+      }
+    }
+    inst->sample_index = sample_index;
+    inst->rendered_samples = rendered_samples;
+    inst->random_state = random_state;
+    return rbn_success;
+  }
+#endif
+
+#ifdef RBN_ATTACK_CACHE
+  size_t rbn_attack_cache_slot_size(const rbn_instance* inst, float max_time) {
+    const uint32_t slot_blocks = (uint32_t)(max_time * inst->config.sample_rate / RBN_BLOCK_SAMPLES) + 1;
+    size_t size = sizeof(rbn_attack_slot);
+    size += (size_t)(slot_blocks + 1) * RBN_ATTACK_STATE_FLOATS * sizeof(float);
+    size += (size_t)slot_blocks * RBN_BLOCK_SAMPLES * sizeof(float);
+    // Keeps the next header aligned
+    return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+  }
+
+  rbn_result rbn_attack_cache_init(rbn_instance* inst, void* memory, size_t size, float max_time) {
+    rbn_attack_cache* cache = &inst->attack_cache;
+    RBN_MEMSET(cache, 0, sizeof(*cache));
+    for(uintptr_t i = 0; i < RBN_VOICE_COUNT; i++) {
+      inst->voices[i].attack = NULL;
+    }
+    if(!memory) {
+      return rbn_success;
+    }
+
+    const size_t slot_size = rbn_attack_cache_slot_size(inst, max_time);
+    if(size < slot_size) {
+      return rbn_buffer_too_small;
+    }
+    cache->memory = (uint8_t*)memory;
+    cache->slot_size = slot_size;
+    cache->slot_count = (uint32_t)(size / slot_size);
+    cache->slot_blocks = (uint32_t)(max_time * inst->config.sample_rate / RBN_BLOCK_SAMPLES) + 1;
+    rbn_attack_forget(inst);
+    return rbn_success;
+  }
+#endif
+
+#ifdef RBN_STATS
+  rbn_result rbn_get_stats(const rbn_instance* inst, rbn_stats* stats) {
+    const rbn_stats* src = &inst->stats;
+    stats->active_voices = RBN_STATS_LOAD(src->active_voices);
+    stats->peak_voices = RBN_STATS_LOAD(src->peak_voices);
+    stats->voice_allocation_failures = RBN_STATS_LOAD(src->voice_allocation_failures);
+    for(uintptr_t i = 0; i < sizeof(stats->messages) / sizeof(*stats->messages); i++) {
+      stats->messages[i] = RBN_STATS_LOAD(src->messages[i]);
+    }
+    stats->voice_blocks = RBN_STATS_LOAD(src->voice_blocks);
+    stats->blocks = RBN_STATS_LOAD(src->blocks);
+    stats->idle_blocks = RBN_STATS_LOAD(src->idle_blocks);
+    stats->max_block_time = RBN_STATS_LOAD(src->max_block_time);
+    for(uintptr_t i = 0; i < RBN_STATS_HISTOGRAM_BUCKETS; i++) {
+      stats->block_time_histogram[i] = RBN_STATS_LOAD(src->block_time_histogram[i]);
+    }
+#ifdef RBN_ATTACK_CACHE
+    stats->attack_hits = RBN_STATS_LOAD(src->attack_hits);
+    stats->attack_misses = RBN_STATS_LOAD(src->attack_misses);
+#endif
+    return rbn_success;
+  }
+#endif
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,251 @@
+#include <string.h>
+
+#include "../robin.h"
+
+#define RBNUTIL_WORKLOAD_TONAL_PROGRAMS 128
+#define RBNUTIL_WORKLOAD_MAX_POLYPHONY 256
+
+typedef enum rbnutil_workload_kind {
+  rbnutil_workload_polyphony = 1 << 0, // Chords as large as the polyphony on the densest programs, struck every second
+  rbnutil_workload_retrigger = 1 << 1, // Every tonal channel cutting its note short to start another
+  rbnutil_workload_bend = 1 << 2, // Pitch bend random walks on all channels, over held notes
+  rbnutil_workload_percussion = 1 << 3, // Rolls of several random keymapped keys struck together
+  rbnutil_workload_controls = 1 << 4, // Volume, expression, pan and modulation changes on all channels, over held notes
+  rbnutil_workload_all = (1 << 5) - 1,
+} rbnutil_workload_kind;
+
+// Rates are in events per second and per channel, generation runs on a millisecond grid so they
+// top out at 1000
+typedef struct rbnutil_workload {
+  uint32_t kinds;
+  uint32_t seed; // The same seed always generates the same events
+  uint32_t sample_rate;
+  uint32_t duration_ms;
+  uint32_t polyphony; // Notes held at once
+  uint32_t retrigger_rate;
+  uint32_t bend_rate;
+  uint32_t percussion_rate;
+  uint32_t percussion_keys; // Distinct keys struck on each percussion hit
+  uint32_t control_rate;
+} rbnutil_workload;
+
+static const char* const workload_names[] = {
+  "polyphony",
+  "retrigger",
+  "bend",
+  "percussion",
+  "controls",
+};
+
+typedef struct workload_state {
+  const rbnutil_workload* workload;
+  rbn_event* events;
+  uint32_t capacity;
+  uint32_t count;
+  uint32_t random;
+} workload_state;
+
+static uint32_t workload_random(workload_state* state, uint32_t range) {
+  state->random ^= state->random << 13;
+  state->random ^= state->random >> 17;
+  state->random ^= state->random << 5;
+  return state->random % range;
+}
+
+// Events past the capacity are still counted so the caller can size its buffer
+static void workload_emit(workload_state* state, uint32_t time, uint8_t channel, uint8_t type, uint8_t data1, uint8_t data2) {
+  if(state->count < state->capacity) {
+    rbn_event* event = state->events + state->count;
+    event->sample = (uint32_t)((uint64_t)time * state->workload->sample_rate / 1000);
+    event->msg.u32 = 0;
+    event->msg.channel = channel;
+    event->msg.type = type;
+    event->msg.key = data1;
+    event->msg.velocity = data2;
+  }
+  state->count++;
+}
+
+// Whether an event at the given rate falls in this millisecond, offset per channel so that channels
+// don't all fire at once
+static int workload_due(uint32_t time, uint32_t channel, uint32_t rate) {
+  const uint64_t shifted = time + channel * 7;
+  return rate > 0 && (shifted + 1) * rate / 1000 > shifted * rate / 1000;
+}
+
+static int workload_is_tonal(uint8_t channel) {
+#ifdef RBN_KEYMAP_CHANNEL
+  return channel != RBN_KEYMAP_CHANNEL;
+#else
+  return 1;
+#endif
+}
+
+// Operators in use count first, then how many modulate each other
+static uint32_t workload_program_density(const rbn_program* program) {
+  uint32_t density = 0;
+  for(uintptr_t i = 0; i < RBN_OPERATOR_COUNT; i++) {
+    if(program->operator_usage_mask & (1 << i)) {
+      density += RBN_OPERATOR_COUNT * RBN_OPERATOR_COUNT;
+      for(uintptr_t j = 0; j < RBN_OPERATOR_COUNT; j++) {
+        density += program->op_matrix[i][j] != 0.f;
+      }
+    }
+  }
+  return density;
+}
+
+// Fills programs with the densest tonal programs in decreasing order
+static void workload_densest_programs(const rbn_instance* inst, uint8_t* programs, uint32_t count) {
+  const uint32_t program_count = RBN_PROGRAM_COUNT < RBNUTIL_WORKLOAD_TONAL_PROGRAMS ? RBN_PROGRAM_COUNT : RBNUTIL_WORKLOAD_TONAL_PROGRAMS;
+  uint8_t picked[RBNUTIL_WORKLOAD_TONAL_PROGRAMS] = {0};
+  for(uint32_t i = 0; i < count; i++) {
+    uint32_t best = 0;
+    uint32_t best_density = 0;
+    for(uint32_t j = 0; j < program_count; j++) {
+      const uint32_t density = workload_program_density(inst->programs + j);
+      if(!picked[j] && density >= best_density) {
+        best = j;
+        best_density = density;
+      }
+    }
+    picked[best] = 1;
+    programs[i] = (uint8_t)best;
+  }
+}
+
+void rbnutil_workload_defaults(rbnutil_workload* workload, uint32_t kinds, uint32_t seed, uint32_t sample_rate) {
+  workload->kinds = kinds;
+  workload->seed = seed;
+  workload->sample_rate = sample_rate;
+  workload->duration_ms = 10000;
+  workload->polyphony = RBN_VOICE_COUNT;
+  workload->retrigger_rate = 32;
+  workload->bend_rate = 200;
+  workload->percussion_rate = 100;
+  workload->percussion_keys = 4;
+  workload->control_rate = 100;
+}
+
+// Comma separated kind names or "all", returns zero if any is unknown
+uint32_t rbnutil_workload_parse_kinds(const char* names) {
+  if(!strcmp(names, "all")) {
+    return rbnutil_workload_all;
+  }
+  uint32_t kinds = 0;
+  while(*names) {
+    const size_t len = strcspn(names, ",");
+    uint32_t i = 0;
+    while(i < sizeof(workload_names) / sizeof(*workload_names)
+      && (strlen(workload_names[i]) != len || strncmp(names, workload_names[i], len))) {
+      i++;
+    }
+    if(i == sizeof(workload_names) / sizeof(*workload_names)) {
+      return 0;
+    }
+    kinds |= 1 << i;
+    names += names[len] ? len + 1 : len;
+  }
+  return kinds;
+}
+
+const char* rbnutil_workload_name(rbnutil_workload_kind kind) {
+  for(uint32_t i = 0; i < sizeof(workload_names) / sizeof(*workload_names); i++) {
+    if(kind == 1u << i) {
+      return workload_names[i];
+    }
+  }
+  return "all";
+}
+
+// Writes up to capacity events sorted by sample and returns how many the workload has, so it can be
+// called first with no buffer. Program choice depends on the instance's programs, refreshed beforehand
+uint32_t rbnutil_workload_generate(const rbnutil_workload* workload, const rbn_instance* inst, rbn_event* events, uint32_t capacity) {
+  workload_state state = {
+    .workload = workload,
+    .events = events,
+    .capacity = events ? capacity : 0,
+    .random = workload->seed ? workload->seed : 1,
+  };
+
+  uint8_t programs[RBN_CHAN_COUNT];
+  workload_densest_programs(inst, programs, RBN_CHAN_COUNT);
+  uint8_t held_channels[RBNUTIL_WORKLOAD_MAX_POLYPHONY];
+  uint8_t held_keys[RBNUTIL_WORKLOAD_MAX_POLYPHONY];
+  uint32_t held_count = 0;
+  uint8_t retriggered_keys[RBN_CHAN_COUNT] = {0};
+  uint16_t bends[RBN_CHAN_COUNT];
+  for(uint8_t c = 0; c < RBN_CHAN_COUNT; c++) {
+    bends[c] = 0x2000;
+  }
+  uint8_t tonal_channels[RBN_CHAN_COUNT];
+  uint32_t tonal_count = 0;
+  for(uint8_t c = 0; c < RBN_CHAN_COUNT; c++) {
+    if(workload_is_tonal(c)) {
+      tonal_channels[tonal_count++] = c;
+      workload_emit(&state, 0, c, rbn_program_change, programs[tonal_count - 1], 0);
+    }
+  }
+  // Channel messages need voices to update, so they get a note per channel when nothing else plays
+  uint32_t polyphony = workload->polyphony < RBNUTIL_WORKLOAD_MAX_POLYPHONY ? workload->polyphony : RBNUTIL_WORKLOAD_MAX_POLYPHONY;
+  int strikes = (workload->kinds & rbnutil_workload_polyphony) != 0;
+  if(!strikes && !(workload->kinds & rbnutil_workload_retrigger) && (workload->kinds & (rbnutil_workload_bend | rbnutil_workload_controls))) {
+    polyphony = tonal_count;
+    strikes = 1;
+  }
+
+  for(uint32_t time = 0; time < workload->duration_ms; time++) {
+    if(strikes && time % 1000 == 0 && tonal_count > 0) {
+      for(uint32_t i = 0; i < held_count; i++) {
+        workload_emit(&state, time, held_channels[i], rbn_note_off, held_keys[i], 0);
+      }
+      for(held_count = 0; held_count < polyphony; held_count++) {
+        held_channels[held_count] = tonal_channels[held_count % tonal_count];
+        held_keys[held_count] = (uint8_t)(36 + workload_random(&state, 60));
+        workload_emit(&state, time, held_channels[held_count], rbn_note_on, held_keys[held_count], (uint8_t)(96 + workload_random(&state, 32)));
+      }
+    }
+
+    if(workload->kinds & rbnutil_workload_retrigger) {
+      for(uint32_t i = 0; i < tonal_count; i++) {
+        const uint8_t c = tonal_channels[i];
+        if(workload_due(time, c, workload->retrigger_rate)) {
+          if(retriggered_keys[c]) {
+            workload_emit(&state, time, c, rbn_note_off, retriggered_keys[c], 0);
+          }
+          retriggered_keys[c] = (uint8_t)(36 + workload_random(&state, 60));
+          workload_emit(&state, time, c, rbn_note_on, retriggered_keys[c], (uint8_t)(64 + workload_random(&state, 64)));
+        }
+      }
+    }
+
+#ifdef RBN_KEYMAP_CHANNEL
+    // Limited to the 47 General MIDI percussion keys, stepping by a coprime stride keeps them distinct
+    if((workload->kinds & rbnutil_workload_percussion) && workload_due(time, RBN_KEYMAP_CHANNEL, workload->percussion_rate)) {
+      const uint32_t first = workload_random(&state, 47);
+      const uint32_t stride = 1 + workload_random(&state, 46);
+      const uint32_t keys = workload->percussion_keys < 47 ? workload->percussion_keys : 47;
+      for(uint32_t i = 0; i < keys; i++) {
+        workload_emit(&state, time, RBN_KEYMAP_CHANNEL, rbn_note_on, (uint8_t)(35 + (first + i * stride) % 47), (uint8_t)(64 + workload_random(&state, 64)));
+      }
+    }
+#endif
+
+    for(uint8_t c = 0; c < RBN_CHAN_COUNT; c++) {
+      if((workload->kinds & rbnutil_workload_bend) && workload_due(time, c, workload->bend_rate)) {
+        const int32_t bend = bends[c] + (int32_t)workload_random(&state, 0x801) - 0x400;
+        bends[c] = (uint16_t)(bend < 0 ? 0 : bend > 0x3fff ? 0x3fff : bend);
+        workload_emit(&state, time, c, rbn_pitch_bend, bends[c] & 0x7f, (uint8_t)(bends[c] >> 7));
+      }
+      if((workload->kinds & rbnutil_workload_controls) && workload_due(time, c, workload->control_rate)) {
+        // Volume and expression stay high enough for voices to keep being heard
+        static const uint8_t controls[] = {rbn_volume, rbn_expression, rbn_pan, rbn_modulation_wheel};
+        const uint8_t control = controls[workload_random(&state, sizeof(controls))];
+        const uint8_t value = (uint8_t)(control == rbn_volume || control == rbn_expression ? 64 + workload_random(&state, 64) : workload_random(&state, 128));
+        workload_emit(&state, time, c, rbn_control_change, control, value);
+      }
+    }
+  }
+
+  return state.count;
+}